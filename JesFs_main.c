@@ -9,6 +9,7 @@
 * - Nordic nRF52832 DK_PCA10040 (nRF52)
 * - Windows (Compilers: "Embarcadero(R) C++ Builder Community Edition" (for PC)
 *           and "Microsoft Visual Studio Community 2019")
+* - Linux (host build with the simulated flash, see 'platform_LINUX')
 *
 * Can be used as standalone project or in combination with secure JesFsBoot Bootloader
 *
@@ -35,6 +36,7 @@
 * 02.04.2022 improved fs_checkdisk() (nRF52840 J-TAG corrupted FlashDisk via QSPI)
 * 17.03.2023 added _feature supply_voltage_check();
 * 14.09.2023 all global fs_-functions check _supply_voltage_check() on entry
+* 17.10.2026 added Linux host build (CMake)
 *******************************************************************************/
 
 #define VERSION "17.03.2023"
@@ -71,6 +73,9 @@
 	extern int16_t ll_setid_vdisk(uint32_t id);
 	extern int16_t ll_get_info_vdisk(uint32_t * pid_used, uint8_t * *pmem, uint32_t * psize);
 #endif
+#ifdef __linux__
+	#include "jesfs_ll_linux.h"	// Helpers for the mmap()ed virtual Disk on Linux
+#endif
 
 //======= Toolbox =======
 #include "tb_tools.h"
@@ -288,7 +293,7 @@ int main(void) { // renamed to mainThread() on CCxxyy
                         // The creation Flags
                         if(fs_stat.disk_flags & SF_OPEN_CRC) tb_printf(" CRC32:%x",fs_stat.file_crc32);
                         if(fs_stat.disk_flags & SF_OPEN_EXT_SYNC) tb_printf(" ExtSync");
-                        //if(fs_stat.disk_flags & _SF_OPEN_RES) tb_printf(" Reserved");
+                        if(fs_stat.disk_flags & SF_OPEN_RING) tb_printf(" Ring");
                         conv_secs_to_date_sbuffer(fs_stat.file_ctime);
                         tb_printf(" [%s]\n",sbuffer);
                     }
@@ -486,6 +491,29 @@ int main(void) { // renamed to mainThread() on CCxxyy
                 break;
 #endif
 
+#ifdef __linux__
+            // On Linux the virtual Disk/Flash is an image file, mapped to memory
+            case '+':
+                tb_printf("'+': Sync VirtualDisk to its File\n");
+                res=ll_sync_vdisk();
+                tb_printf("Res: %d\n",res);
+                break;
+
+            case '#':
+                tb_printf("'#': Use File as VirtualDisk: '%s'\n",pc);
+                res=ll_open_vdisk(pc);
+                tb_printf("Res: %d\n",res);
+                tb_printf("FS Init Normal:%d\n",fs_start(FS_START_NORMAL));
+                break;
+
+            case '$':
+                // Manually select size of virtual Flash
+                anz=strtoul(pc,NULL,0);
+                tb_printf("'$': Set vdisk ID: $%x/%d\n",anz,anz);
+                ll_setid_vdisk(anz);
+                break;
+#endif
+
             default:
                 tb_printf("???\n");
                 break;
@@ -28,6 +28,32 @@
  * 1.94 / 21.06.2026 hardened jesfs_read(), jesfs_check_disk(), and jesfs_open()
  * ----
  * 2.00 / 21.06.2026 Zephyr-OS port, added jesfs_is_awake()
+ * 2.01 / 17.10.2026 Linux host build, added SPI counters (JSTAT)
+ * 2.02 / 17.10.2026 Linux: datasheet timing model of the simulated flash
+ * 2.03 / 17.10.2026 Linux: added jesfs_bench
+ * 2.04 / 17.10.2026 added JESFS_FREE_BITMAP (RAM bitmap of free sectors)
+ * 2.05 / 17.10.2026 added JESFS_CHECKPOINT, jesfs_checkpoint(): anchor in the last index slot
+ * 2.06 / 17.10.2026 added JESFS_NAME_INDEX (RAM filename hash index)
+ * 2.07 / 17.10.2026 jesfs_read() keeps the next-sector link in the descriptor
+ * 2.08 / 17.10.2026 added JESFS_TAIL_CACHE (end of unclosed files kept over sleep)
+ * 2.09 / 17.10.2026 table-driven CRC32 (JESFS_CRC32), JESFS_CRC32_HW
+ * 2.10 / 17.10.2026 added JESFS_GC, jesfs_gc()
+ * 2.11 / 17.10.2026 added JESFS_ASYNC_ERASE (background erase, erase-suspend)
+ * 2.12 / 17.10.2026 adaptive busy polling
+ * 2.13 / 17.10.2026 added JESFS_WRITE_BUFFER, jesfs_set_write_buffer(), jesfs_flush()
+ * 2.14 / 17.10.2026 32k/64k block erase for soft format and jesfs_gc()
+ * 2.15 / 17.10.2026 blank check for soft format, added FS_FORMAT_TRUST_EMPTY
+ * 2.16 / 17.10.2026 added JESFS_WEAR, jesfs_wear_stat/_save/_level(): erase count table
+ * 2.17 / 17.10.2026 added jesfs_open_ring(): ring files with a sector list in the head
+ * 2.18 / 17.10.2026 added jesfs_open_record(): record files (FTYPE_RECORD)
+ * 2.19 / 17.10.2026 added jesfs_seek(), JESFS_SEEK_CACHE, jesfs_set_seek_cache()
+ * 2.20 / 17.10.2026 added jesfs_read_stream()
+ * 2.21 / 17.10.2026 burst reads of consecutive sectors, preferred on allocation
+ * 2.22 / 17.10.2026 added jesfs_preallocate() (FTYPE_PREALLOC)
+ * 2.23 / 17.10.2026 added JESFS_MULTI_IO (fast, dual and quad SPI commands)
+ * 2.24 / 17.10.2026 added JESFS_SFDP (flash parameters, unknown flash IDs)
+ *        Disks with a checkpoint, wear table, ring, record or preallocated files
+ *        are not readable by 2.01 and older
  *
  *******************************************************************************/
 
@@ -49,7 +75,7 @@
  *
  * Flash ID / connectivity
  * - JESFS_ERR_FLASH_ID_BAD_DENSITY      : Flash ID readable, but density unknown/illegal
- * - JESFS_ERR_FLASH_ID_UNKNOWN          : Flash ID readable, but manufacturer/type unknown
+ * - JESFS_ERR_FLASH_ID_UNKNOWN          : Flash ID readable, but manufacturer/type unknown (no SFDP)
  * - JESFS_ERR_FLASH_ID_MISMATCH         : Flash ID in index differs from hardware ID
  * - JESFS_ERR_FLASH_ID_ZERO_SLEEP       : Flash ID read as 0x000000
  * - JESFS_ERR_FLASH_ID_UNCONNECTED      : Flash ID read as 0xFFFFFF
@@ -89,6 +115,9 @@
  * - JESFS_ERR_RENAME_OPEN_FOR_READ_OR_RAW : Rename not possible when files are open as READ or RAW
  * - JESFS_ERR_RENAME_TARGET_NOT_EMPTY   : Rename requires an empty target file
  * - JESFS_ERR_RENAME_FILES_NOT_OPEN     : Both files must be open for rename
+ * - JESFS_ERR_NO_WRITE_BUFFER_SLOT      : All write buffers in use (JESFS_WRITE_BUFFER)
+ * - JESFS_ERR_BAD_RECORD_SIZE           : Record size 0 or not the one of the record file
+ * - JESFS_ERR_NO_SEEK_CACHE_SLOT        : All seek caches in use (JESFS_SEEK_CACHE)
  *
  * State / power / command constraints
  * - JESFS_ERR_BAD_FORMAT_PARAM          : Illegal format parameter
@@ -162,6 +191,9 @@ typedef int16_t jesfs_err_t;
 #define JESFS_ERR_BAD_MAGIC_HEADER JESFS_ERR(46)
 #define JESFS_ERR_VOLTAGE_TOO_LOW JESFS_ERR(47)
 #define JESFS_ERR_FLASH_NOT_ACCESSIBLE JESFS_ERR(48)
+#define JESFS_ERR_NO_WRITE_BUFFER_SLOT JESFS_ERR(49)
+#define JESFS_ERR_BAD_RECORD_SIZE JESFS_ERR(50)
+#define JESFS_ERR_NO_SEEK_CACHE_SLOT JESFS_ERR(51)
 
 #ifdef __cplusplus
 extern "C" {
@@ -177,13 +209,127 @@ extern "C" {
  *
  * On TI-RTOS and the X110-Emulator on a CC1310 the heap does not like
  * too big chunks. Smaller chunks make transfers slower.
+ * Without SF_RD_TRANSFER_LIMIT, jesfs_read() reads physically consecutive
+ * sectors of a file in one transfer (up to 64k).
  */
 /* #define SF_RD_TRANSFER_LIMIT 64 */
 /* #define SF_TX_TRANSFER_LIMIT 64 */
 
-/* Define this macro for additional statistics. */
+/* Define this macro for additional statistics (incl. SPI counters, see jesfs_get_spi_stat()). */
 #define JSTAT
 
+/*
+ * JESFS_FREE_BITMAP: Keep a RAM bitmap of the free sectors, built by jesfs_start()
+ * (1 bit per sector: 512 Bytes for 16MB). The sector allocation then needs no
+ * flash scan, even on nearly full disks.
+ */
+/* #define JESFS_FREE_BITMAP */
+
+/*
+ * JESFS_CHECKPOINT: jesfs_deepsleep() (or jesfs_checkpoint()) saves the mount
+ * state, so the next jesfs_start() needs no sector scan. The records rotate
+ * through free sectors like data, one reserved sector lists them.
+ * The first flash modification invalidates it, after a power loss the full
+ * scan is used. Note: disks with a checkpoint must not be written by JesFs
+ * versions without JESFS_CHECKPOINT (they would keep a stale checkpoint).
+ */
+/* #define JESFS_CHECKPOINT */
+
+/*
+ * JESFS_NAME_INDEX: Keep a 16-bit name hash and the head sector of each index
+ * entry in RAM (6 Bytes per file, 6k for a full index). jesfs_open() then
+ * reads only the heads with a matching hash, instead of all of them.
+ */
+/* #define JESFS_NAME_INDEX */
+
+/*
+ * JESFS_TAIL_CACHE: Remember the end of unclosed files (e.g. logs) for up to
+ * JESFS_TAIL_CACHE files. Kept over jesfs_deepsleep()/FS_START_RESTART, so
+ * jesfs_read(pdesc, NULL, 0xFFFFFFFF) to append after a wake jumps to the end
+ * instead of walking the sector list and searching the last sector.
+ */
+/* #define JESFS_TAIL_CACHE 4 */
+
+/*
+ * JESFS_CRC32: Implementation of jesfs_track_crc32() (Zephyr uses its own):
+ * 0: Bitwise (default), 1: Nibble table (64 Bytes), 2: Byte table (1 kB),
+ * 3: Slice-by-8 (8 kB). The tables are const (in flash), see jesfs_crc32_tab.h.
+ * JESFS_CRC32_HW: Additionally use the CPU's CRC support for larger blocks
+ * (host builds: x86-64 with PCLMULQDQ (checked at runtime), ARMv8 with CRC32).
+ * All give the same ISO 3309 CRC32.
+ */
+/* #define JESFS_CRC32 2 */
+/* #define JESFS_CRC32_HW */
+
+/*
+ * JESFS_GC: jesfs_gc() erases 'to delete' sectors in idle time, so writes
+ * need no (40-400 msec) sector erase. Up to JESFS_GC_POOL (default 8) erased
+ * sectors are remembered and used first by the allocator (with JESFS_WEAR the least
+ * erased of them, and only if no free sector is less erased).
+ */
+/* #define JESFS_GC */
+/* #define JESFS_GC_POOL 8 */
+
+/*
+ * JESFS_ASYNC_ERASE: jesfs_gc() starts the erase in the background and
+ * returns. Reads meanwhile use erase-suspend/resume (0x75/0x7A, MX25R and
+ * GD25, other flashes: the opcodes of their SFDP, without them reads wait),
+ * writes wait for the end of the erase. Not for Zephyr.
+ */
+/* #define JESFS_ASYNC_ERASE */
+
+/*
+ * JESFS_MULTI_IO: Read with fast read (0x0B) or dual/quad output reads
+ * (0x3B/0x6B/0xEB) and program with quad page program (0x38 MX25R, 0x32
+ * GD25WQ), as far as the flash and the low-level driver support them. The
+ * commands of the flash are known by its ID (other flashes: the reads of
+ * their SFDP, no quad page program). The driver provides sflash_spi_io_caps()
+ * (what it can transfer, SF_IO_xxx, see jesfs_int.h), sets the QE bit of the
+ * flash and transfers the bytes after these commands on their lines.
+ * Not for Zephyr.
+ */
+/* #define JESFS_MULTI_IO */
+
+/*
+ * JESFS_SFDP: Read the flash's SFDP (0x5A, JESD216) at jesfs_start(). Flashes
+ * with an unknown ID are accepted if it shows a 4k sector erase (0x20) and
+ * 3-byte addressing. Its size, erase and program times (busy polling and
+ * timeouts), block erases and read modes are used. Not for Zephyr.
+ */
+/* #define JESFS_SFDP */
+
+/*
+ * JESFS_WRITE_BUFFER: jesfs_set_write_buffer() gives up to JESFS_WRITE_BUFFER
+ * open files a write buffer (caller's memory), so small jesfs_write()s are
+ * collected into full 256-byte page programs. Flushed on a full page,
+ * jesfs_flush(), jesfs_close() and jesfs_deepsleep(). The buffers stay set
+ * if jesfs_start(FS_START_RESTART) only wakes the flash; any other start
+ * releases them.
+ */
+/* #define JESFS_WRITE_BUFFER 2 */
+
+/*
+ * JESFS_SEEK_CACHE: jesfs_set_seek_cache() gives up to JESFS_SEEK_CACHE open
+ * files a table (caller's memory) of the address of every Nth sector, filled
+ * by jesfs_seek(). A seek then follows at most N-1 sector links instead of
+ * the chain from the start. N doubles when the table is full.
+ */
+/* #define JESFS_SEEK_CACHE 2 */
+
+/*
+ * JESFS_WEAR: Count the erases of each sector (RAM: 2 Bytes per sector, 8k
+ * for 16MB). The table is saved in its own sectors (reallocated on each save)
+ * by jesfs_format(), jesfs_wear_save() and by jesfs_deepsleep() after
+ * JESFS_WEAR_SAVE (default 64) erases, so a power off loses less than that.
+ * New data goes to the least erased of the next JESFS_WEAR_WINDOW (default 8)
+ * free sectors, new files reuse the least erased head of a deleted file and
+ * jesfs_wear_level() moves static data to worn sectors.
+ * Requires JESFS_FREE_BITMAP.
+ */
+/* #define JESFS_WEAR */
+/* #define JESFS_WEAR_SAVE 64 */
+/* #define JESFS_WEAR_WINDOW 8 */
+
 /* Supported flash JEDEC IDs (format 0xMMTTDD). */
 
 #define MACRONIX_MANU_TYP_RX 0xC228
@@ -199,12 +345,15 @@ extern "C" {
 #define FS_START_NORMAL 0
 #define FS_START_FAST 1
 /* #define FS_START_PEDANTIC 2 */
+#define FS_START_FULLSCAN 4 /* Ignore a checkpoint (JESFS_CHECKPOINT) */
 #define FS_START_RESTART 128
 
 #if !defined(__ZEPHYR__)
 #define FS_FORMAT_FULL 1 /* Full format (= Bulk Erase) is slow ans old-style, but easy to use */
 #endif
 #define FS_FORMAT_SOFT 2 /* Soft format (= per Sector) is more transparent and more modern */
+/* With FS_FORMAT_SOFT on a started disk: trust empty headers (no blank check) */
+#define FS_FORMAT_TRUST_EMPTY 4
 
 /* Flags for jesfs_open(). */
 #define SF_OPEN_READ 1
@@ -216,7 +365,7 @@ extern "C" {
 #define SF_XOPEN_UNCLOSED 32
 
 #define SF_OPEN_EXT_SYNC 64
-#define _SF_OPEN_RES 128
+#define SF_OPEN_RING 128 /* Ring file, set by jesfs_open_ring() */
 
 /* Flags returned by jesfs_info(). */
 #define FS_STAT_ACTIVE 1
@@ -238,12 +387,15 @@ extern "C" {
 struct jesfs_desc {
 	uint32_t _head_sadr;
 	uint32_t _wrk_sadr;
+	uint32_t _next_sadr; /* Checked link of _wrk_sadr (jesfs_read()), 0: unknown */
 	uint32_t file_pos;
 	uint32_t file_len;
 	uint32_t file_crc32;
 	uint32_t file_ctime;
 	uint16_t _sadr_rel;
+	uint16_t _rec_size; /* Record file (jesfs_open_record()), 0: other file */
 	uint8_t open_flags;
+	uint8_t _prealloc; /* Unclosed, sectors linked ahead (jesfs_preallocate()) */
 };
 
 /** File statistic descriptor returned by jesfs_info(). */
@@ -287,6 +439,9 @@ struct sflash_info {
 	uint16_t sectors_clear;
 	uint16_t sectors_unknown;
 #endif
+#ifdef JESFS_CHECKPOINT
+	uint32_t ckpt_live_adr; /* Valid checkpoint record, 0: none */
+#endif
 
 	union sflash_buffer databuf;
 	uint8_t state_flags;
@@ -294,6 +449,40 @@ struct sflash_info {
 
 extern struct sflash_info sflash_info;
 
+#ifdef JSTAT
+/**
+ * SPI/flash access counters of the medium layer, running since power-on or
+ * jesfs_reset_spi_stat(). On Zephyr the flash driver waits internally,
+ * so the busy counters stay 0 there.
+ */
+struct jesfs_spi_stat {
+	uint32_t transactions;	/* All SPI transactions (select..deselect) */
+	uint32_t reads;		/* sflash_read() calls */
+	uint32_t bytes_read;
+	uint32_t programs;	/* Page program operations */
+	uint32_t bytes_written;
+	uint32_t erases;	/* 4k sector erases */
+	uint32_t block_erases;	/* 32k/64k block erases */
+	uint32_t bulk_erases;
+	uint32_t status_reads;	/* Status register reads (incl. busy polls) */
+	uint32_t busy_polls;	/* Iterations in sflash_wait_busy() */
+	uint32_t busy_usec;	/* Time waited in sflash_wait_busy() */
+	uint32_t erase_suspends; /* Reads during a background erase */
+};
+#endif
+
+#ifdef JESFS_WEAR
+/** Erase counts of the sectors 1..n-1 (sector 0 is only erased by formats). */
+struct jesfs_wear_stat {
+	uint32_t min;
+	uint32_t max;
+	uint32_t mean;
+	uint32_t min_sadr;	/* (First) sector with min, max */
+	uint32_t max_sadr;
+	uint16_t unsaved;	/* Erases since the last jesfs_wear_save() */
+};
+#endif
+
 /** Readable date representation used by jesfs_sec1970_to_date(). */
 struct jesfs_date {
 	uint8_t sec;
@@ -317,6 +506,57 @@ int16_t jesfs_deepsleep(void);
 /** Check if the filesystem is already awake. */
 int16_t jesfs_is_awake(void);
 
+#ifdef JESFS_CHECKPOINT
+/** Save the mount state for a fast jesfs_start() (also done by jesfs_deepsleep()). */
+int16_t jesfs_checkpoint(void);
+#endif
+
+#ifdef JESFS_GC
+/**
+ * Erase up to max_erase deleted sectors in idle time. Returns the number erased
+ * (JESFS_ASYNC_ERASE: 1 while the background erase is running). After a round
+ * that found nothing new, returns 0 without flash access until a sector is
+ * released.
+ */
+int16_t jesfs_gc(uint16_t max_erase);
+#endif
+
+#ifdef JESFS_WRITE_BUFFER
+/**
+ * Buffer the writes of an open file in pbuf (size bytes, 256 for full pages).
+ * pdesc->file_pos counts the data on the flash. NULL: flush and release.
+ */
+int16_t jesfs_set_write_buffer(struct jesfs_desc *pdesc, uint8_t *pbuf, uint16_t size);
+
+/** Write the buffered data of a file (NULL: of all files) to the flash. */
+int16_t jesfs_flush(struct jesfs_desc *pdesc);
+#endif
+
+#ifdef JESFS_SEEK_CACHE
+/**
+ * Cache sector addresses for jesfs_seek() in pcache (entries, e.g. 32), until
+ * the file is closed. Not for ring and record files. NULL: release.
+ */
+int16_t jesfs_set_seek_cache(struct jesfs_desc *pdesc, uint32_t *pcache, uint16_t entries);
+#endif
+
+#ifdef JESFS_WEAR
+/** Get the erase count statistics of the disk. */
+int16_t jesfs_wear_stat(struct jesfs_wear_stat *pws);
+
+/** Save the erase counts if at least min_changes erases happened (0: always). */
+int16_t jesfs_wear_save(uint16_t min_changes);
+
+/**
+ * Move up to max_files closed files with sectors at least min_spread erases
+ * below the maximum to the most erased free sectors. Like jesfs_rename() the
+ * head sector is rewritten: call with a good supply and no open descriptors
+ * of these files. Files larger than the free space are skipped. Returns the
+ * number of moved files.
+ */
+int16_t jesfs_wear_level(uint16_t max_files, uint16_t min_spread);
+#endif
+
 #if !defined(__ZEPHYR__)
 /** Format the filesystem. */
 int16_t jesfs_format(uint8_t fmode);
@@ -328,18 +568,84 @@ int16_t jesfs_format(uint8_t fmode, void cb_prog(uint32_t cur_sect, uint32_t tot
 /** Read data or advance the descriptor when pdest is NULL. */
 int32_t jesfs_read(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t len);
 
+/**
+ * Read up to len bytes without a caller buffer: each chunk (up to
+ * SF_BUFFER_SIZE_B, never across a sector) is read into sflash_info.databuf
+ * and passed to cb_chunk(), e.g. for a CRC or an upload. cb_chunk() must not
+ * call JesFs, a non-zero return stops. cb_chunk NULL: only the CRC
+ * (SF_OPEN_CRC). Returns the number of bytes or an error (or cb_chunk()'s
+ * negative return).
+ */
+int32_t jesfs_read_stream(struct jesfs_desc *pdesc, uint32_t len,
+			  int16_t cb_chunk(void *ctx, const uint8_t *pdata, uint16_t clen),
+			  void *ctx);
+
 /** Rewind an open read descriptor. */
 int16_t jesfs_rewind(struct jesfs_desc *pdesc);
 
+/**
+ * Position an open read descriptor at pos (up to the end of the file). Returns
+ * the new position or an error. Forward seeks start at the current sector,
+ * JESFS_SEEK_CACHE also jumps back. The CRC (SF_OPEN_CRC) is only valid for
+ * reads from the start.
+ */
+int32_t jesfs_seek(struct jesfs_desc *pdesc, uint32_t pos);
+
 /** Open or create a file. */
 int16_t jesfs_open(struct jesfs_desc *pdesc, const char *pname, uint8_t flags);
 
+/**
+ * Create a ring file: it keeps at least max_len bytes, writes beyond drop its
+ * oldest sector (the start moves, jesfs_read() starts there). The data is in
+ * the sectors after the head, max_len is rounded up to sectors (4084 bytes)
+ * plus the one being written. With SF_OPEN_RAW an existing ring file is
+ * continued (max_len as created). jesfs_close() stores no length, so the end
+ * is always found as for unclosed files. No SF_OPEN_CRC, no jesfs_rename().
+ */
+int16_t jesfs_open_ring(struct jesfs_desc *pdesc, const char *pname, uint8_t flags,
+			uint32_t max_len);
+
+/**
+ * Create a record file of records with rec_size bytes. A list of its sectors
+ * in the head (the first 4 MB, then the chain is followed) finds record n
+ * without reading the file. The data is in the sectors after the head. With
+ * SF_OPEN_RAW an existing record file (also unclosed) is continued at its
+ * end, a record cut by a power fail is completed with 0xFF.
+ * No SF_OPEN_CRC, no jesfs_rename().
+ */
+int16_t jesfs_open_record(struct jesfs_desc *pdesc, const char *pname, uint8_t flags,
+			  uint16_t rec_size);
+
+/** Append a record (rec_size bytes) to a record file. */
+int16_t jesfs_append_record(struct jesfs_desc *pdesc, const uint8_t *prec);
+
+/**
+ * Read record n of a record file opened for reading. jesfs_read() continues
+ * after it, e.g. for all records since n. Returns rec_size, 0 if n is beyond
+ * the end, or an error.
+ */
+int32_t jesfs_read_record(struct jesfs_desc *pdesc, uint32_t n, uint8_t *pdest);
+
+/** Number of records of a record file (also of an unclosed one). */
+int32_t jesfs_record_count(struct jesfs_desc *pdesc);
+
 /** Return 0 when a file exists, otherwise a negative JesFs error. */
 int16_t jesfs_notexists(const char *pname);
 
 /** Write data to an open descriptor. */
 int16_t jesfs_write(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len);
 
+/**
+ * Reserve the sectors for len more bytes of a file open for writing (e.g. an
+ * OTA image of known size): they are erased and linked in one pass, preferably
+ * consecutive. jesfs_write() then only programs pages, and a full disk fails
+ * here, before anything is written. Unused sectors stay with the file until
+ * it is deleted. Until jesfs_close() the end is in the sector before the first
+ * linked sector that is still blank (found there as for other unclosed files).
+ * Not for ring and record files.
+ */
+int16_t jesfs_preallocate(struct jesfs_desc *pdesc, uint32_t len);
+
 /** Close and finalize an open descriptor. */
 int16_t jesfs_close(struct jesfs_desc *pdesc);
 
@@ -367,6 +673,14 @@ void jesfs_set_static_secs(uint32_t newsecs);
 /** Run a structural and CRC diagnostic scan. */
 int16_t jesfs_check_disk(void cb_printf(const char *fmt, ...));
 
+#ifdef JSTAT
+/** Copy the SPI/flash access counters. */
+void jesfs_get_spi_stat(struct jesfs_spi_stat *pstat);
+
+/** Reset the SPI/flash access counters, e.g. before measuring one operation. */
+void jesfs_reset_spi_stat(void);
+#endif
+
 #if !defined(__ZEPHYR__)
 /*
  * Legacy bare-metal API names.
@@ -389,10 +703,18 @@ typedef struct jesfs_date FS_DATE;
 #define fs_is_awake jesfs_is_awake
 #define fs_format jesfs_format
 #define fs_read jesfs_read
+#define fs_read_stream jesfs_read_stream
 #define fs_rewind jesfs_rewind
+#define fs_seek jesfs_seek
 #define fs_open jesfs_open
+#define fs_open_ring jesfs_open_ring
+#define fs_open_record jesfs_open_record
+#define fs_append_record jesfs_append_record
+#define fs_read_record jesfs_read_record
+#define fs_record_count jesfs_record_count
 #define fs_notexists jesfs_notexists
 #define fs_write jesfs_write
+#define fs_preallocate jesfs_preallocate
 #define fs_close jesfs_close
 #define fs_delete jesfs_delete
 #define fs_rename jesfs_rename
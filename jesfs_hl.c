@@ -18,6 +18,15 @@
 #endif
 #include <zephyr/sys/crc.h>
 #endif
+#if !defined(__ZEPHYR__) && defined(JESFS_CRC32_HW)
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CRC32_HW_PCLMUL
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32_HW_ARM
+#endif
+#endif
 
 /* ---------------------------------------------- JesFs start ---------------------- */
 #include "jesfs.h"
@@ -200,11 +209,121 @@ uint32_t jesfs_date_to_sec1970(const struct jesfs_date *pd)
 	return nsec;
 }
 
-/* Track CRC32 over a stream. Also useful for callers outside the filesystem. */
+#if !defined(__ZEPHYR__) && defined(JESFS_CRC32) && JESFS_CRC32 > 0
+#include "jesfs_crc32_tab.h"
+#endif
+
+#ifdef CRC32_HW_PCLMUL
+/*
+ * Fold 16-byte blocks by carry-less multiplication (Intel: "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction"), constants
+ * for the reflected ISO 3309 polynomial. len: >= 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1"))) static uint32_t
+crc32_pclmul(const uint8_t *pdata, uint32_t len, uint32_t crc_run)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, t1, t2, t3, t4;
+
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pdata), _mm_cvtsi32_si128(crc_run));
+	x2 = _mm_loadu_si128((const __m128i *)(pdata + 16));
+	x3 = _mm_loadu_si128((const __m128i *)(pdata + 32));
+	x4 = _mm_loadu_si128((const __m128i *)(pdata + 48));
+	pdata += 64;
+	len -= 64;
+
+	/* 4 blocks in parallel */
+	while (len >= 64) {
+		t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), t1);
+		x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), t2);
+		x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), t3);
+		x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), t4);
+		x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)pdata));
+		x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i *)(pdata + 16)));
+		x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i *)(pdata + 32)));
+		x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i *)(pdata + 48)));
+		pdata += 64;
+		len -= 64;
+	}
+
+	/* Into one block, then the rest */
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2),
+			   _mm_clmulepi64_si128(x1, k3k4, 0x00));
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3),
+			   _mm_clmulepi64_si128(x1, k3k4, 0x00));
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4),
+			   _mm_clmulepi64_si128(x1, k3k4, 0x00));
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)pdata);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2),
+				   _mm_clmulepi64_si128(x1, k3k4, 0x00));
+		pdata += 16;
+		len -= 16;
+	}
+
+	/* 128 -> 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+/*
+ * Track CRC32 over a stream. Also useful for callers outside the filesystem.
+ * All implementations (JESFS_CRC32, JESFS_CRC32_HW) give the same result.
+ */
 #define POLY32 0xEDB88320 /* ISO 3309 */
 uint32_t jesfs_track_crc32(const uint8_t *pdata, uint32_t wlen, uint32_t crc_run)
 {
 #if !defined(__ZEPHYR__)
+#if defined(CRC32_HW_PCLMUL)
+	static int8_t has_pclmul = -1; /* Unknown */
+
+	if (wlen >= 64) {
+		if (has_pclmul < 0) {
+			has_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+		}
+		if (has_pclmul) {
+			uint32_t blen = wlen & ~15UL;
+
+			crc_run = crc32_pclmul(pdata, blen, crc_run);
+			pdata += blen;
+			wlen -= blen;
+		}
+	}
+#elif defined(CRC32_HW_ARM)
+	while (wlen >= 8) {
+		crc_run = __crc32d(crc_run, (uint64_t)pdata[0] | (uint64_t)pdata[1] << 8 |
+						    (uint64_t)pdata[2] << 16 | (uint64_t)pdata[3] << 24 |
+						    (uint64_t)pdata[4] << 32 | (uint64_t)pdata[5] << 40 |
+						    (uint64_t)pdata[6] << 48 | (uint64_t)pdata[7] << 56);
+		pdata += 8;
+		wlen -= 8;
+	}
+	while (wlen--) {
+		crc_run = __crc32b(crc_run, *pdata++);
+	}
+#endif
+
+#if !defined(JESFS_CRC32) || JESFS_CRC32 == 0
 	uint8_t j;
 	while (wlen--) {
 		crc_run ^= *pdata++;
@@ -216,6 +335,33 @@ uint32_t jesfs_track_crc32(const uint8_t *pdata, uint32_t wlen, uint32_t crc_run
 			}
 		}
 	}
+#elif JESFS_CRC32 == 1
+	while (wlen--) {
+		crc_run ^= *pdata++;
+		crc_run = (crc_run >> 4) ^ crc32_tab4[crc_run & 15];
+		crc_run = (crc_run >> 4) ^ crc32_tab4[crc_run & 15];
+	}
+#else
+#if JESFS_CRC32 == 3
+	/* Slice-by-8: 8 bytes per step (byte order independent) */
+	while (wlen >= 8) {
+		uint32_t lo = crc_run ^ ((uint32_t)pdata[0] | (uint32_t)pdata[1] << 8 |
+					 (uint32_t)pdata[2] << 16 | (uint32_t)pdata[3] << 24);
+		uint32_t hi = (uint32_t)pdata[4] | (uint32_t)pdata[5] << 8 |
+			      (uint32_t)pdata[6] << 16 | (uint32_t)pdata[7] << 24;
+
+		crc_run = crc32_tab[7][lo & 0xFF] ^ crc32_tab[6][(lo >> 8) & 0xFF] ^
+			  crc32_tab[5][(lo >> 16) & 0xFF] ^ crc32_tab[4][lo >> 24] ^
+			  crc32_tab[3][hi & 0xFF] ^ crc32_tab[2][(hi >> 8) & 0xFF] ^
+			  crc32_tab[1][(hi >> 16) & 0xFF] ^ crc32_tab[0][hi >> 24];
+		pdata += 8;
+		wlen -= 8;
+	}
+#endif
+	while (wlen--) {
+		crc_run = (crc_run >> 8) ^ crc32_tab[0][(crc_run ^ *pdata++) & 0xFF];
+	}
+#endif
 	return crc_run;
 #else
 	/* Zephyr has a built-in ISO 3309 CRC32 implementation; requires CONFIG_CRC=y. */
@@ -223,6 +369,375 @@ uint32_t jesfs_track_crc32(const uint8_t *pdata, uint32_t wlen, uint32_t crc_run
 #endif
 }
 
+#ifdef JESFS_FREE_BITMAP
+/*
+ * Allocatable sectors (empty or 'to delete'), 1 bit per sector. Sector 0 and
+ * bits above the flash size are never set.
+ */
+#define SF_FREE_BITMAP_WORDS ((1UL << MAX_DENSITY) / SF_SECTOR_PH / 32)
+static uint32_t sflash_free_bitmap[SF_FREE_BITMAP_WORDS];
+static uint8_t sflash_free_bitmap_valid; /* Set by jesfs_start() */
+
+static void free_bitmap_set(uint32_t sadr)
+{
+	sadr /= SF_SECTOR_PH;
+	sflash_free_bitmap[sadr >> 5] |= (1UL << (sadr & 31));
+}
+
+static void free_bitmap_clear(uint32_t sadr)
+{
+	sadr /= SF_SECTOR_PH;
+	sflash_free_bitmap[sadr >> 5] &= ~(1UL << (sadr & 31));
+}
+
+/* Next allocatable sector after sadr (round robin), 0: none */
+static uint32_t free_bitmap_next(uint32_t sadr)
+{
+	uint32_t nsect = sflash_info.total_flash_size / SF_SECTOR_PH;
+	uint32_t nwords = (nsect + 31) / 32;
+	uint32_t sect = sadr / SF_SECTOR_PH + 1;
+	uint32_t widx;
+	uint32_t bits;
+	uint32_t i;
+
+	if (sect >= nsect) {
+		sect = 1;
+	}
+	widx = sect >> 5;
+	bits = sflash_free_bitmap[widx] & (0xFFFFFFFFUL << (sect & 31));
+	/* Up to one more word: the start word again (lower bits) */
+	for (i = 0; i <= nwords; i++) {
+		if (bits) {
+			sect = widx << 5;
+			while (!(bits & 1)) {
+				bits >>= 1;
+				sect++;
+			}
+			return sect * SF_SECTOR_PH;
+		}
+		if (++widx >= nwords) {
+			widx = 0;
+		}
+		bits = sflash_free_bitmap[widx];
+	}
+	return 0;
+}
+#endif
+
+#ifdef JESFS_NAME_INDEX
+/*
+ * Name hash and head sector per index entry (same order as on flash). Built
+ * by jesfs_start() or (e.g. after a checkpoint) by the first jesfs_open().
+ */
+#define NAME_INDEX_SLOTS ((SF_SECTOR_PH - HEADER_SIZE_B - 4) / 4)
+#define NAME_HASH_DELETED 0 /* Head of a deleted file */
+static uint32_t name_index_sadr[NAME_INDEX_SLOTS];
+static uint16_t name_index_hash[NAME_INDEX_SLOTS];
+static uint8_t name_index_valid;
+
+/* FNV-1a, folded to 16 bits. Never NAME_HASH_DELETED. */
+static uint16_t name_hash(const char *pname)
+{
+	uint32_t h = 2166136261UL;
+	uint8_t i;
+
+	for (i = 0; i <= FNAMELEN && pname[i]; i++) {
+		h ^= (uint8_t)pname[i];
+		h *= 16777619UL;
+	}
+	h = (h >> 16) ^ (h & 0xFFFF);
+	return h ? (uint16_t)h : 1;
+}
+
+/* Enter the head in sflash_info.databuf (header and FINFO) */
+static void name_index_put(uint16_t slot, uint32_t sadr)
+{
+	name_index_sadr[slot] = sadr;
+	if (sflash_info.databuf.u32[0] == SECTOR_MAGIC_HEAD_ACTIVE) {
+		sflash_info.databuf.u8[HEADER_SIZE_B + 12 + FNAMELEN] = 0; /* Terminated */
+		name_index_hash[slot] = name_hash((char *)&sflash_info.databuf.u8[HEADER_SIZE_B + 12]);
+	} else {
+		name_index_hash[slot] = NAME_HASH_DELETED;
+	}
+}
+
+/* New hash for the head sadr (if known) */
+static void name_index_set(uint32_t sadr, uint16_t hash)
+{
+	uint16_t i;
+
+	for (i = 0; i < sflash_info.files_used; i++) {
+		if (name_index_sadr[i] == sadr) {
+			name_index_hash[i] = hash;
+			return;
+		}
+	}
+}
+
+/* Read all heads, as jesfs_open() without the name index */
+static int16_t name_index_build(void)
+{
+	uint32_t sadr;
+	uint16_t i;
+	int16_t res;
+
+	for (i = 0; i < sflash_info.files_used; i++) {
+		res = sflash_read(HEADER_SIZE_B + i * 4, (uint8_t *)&sadr, 4);
+		if (res) {
+			return res;
+		}
+		res = sflash_read(sadr, (uint8_t *)&sflash_info.databuf,
+				  HEADER_SIZE_B + FINFO_SIZE_B);
+		if (res) {
+			return res;
+		}
+		if (sflash_info.databuf.u32[0] != SECTOR_MAGIC_HEAD_ACTIVE &&
+		    sflash_info.databuf.u32[0] != SECTOR_MAGIC_HEAD_DELETED) {
+			return JESFS_ERR_INDEX_CORRUPTED;
+		}
+		name_index_put(i, sadr);
+	}
+	name_index_valid = 1;
+	return 0;
+}
+
+/*
+ * Find the active file pname: *psadr is its head (in sflash_info.databuf) or
+ * 0, *psfun_adr the head of a deleted file (if any, for reuse).
+ */
+static int16_t name_index_find(const char *pname, uint32_t *psadr, uint32_t *psfun_adr)
+{
+	uint16_t hash = name_hash(pname);
+	uint16_t i;
+	int16_t res;
+
+	*psadr = 0;
+	if (!name_index_valid) {
+		res = name_index_build();
+		if (res) {
+			return res;
+		}
+	}
+	for (i = 0; i < sflash_info.files_used; i++) {
+		if (name_index_hash[i] == NAME_HASH_DELETED) {
+			*psfun_adr = name_index_sadr[i];
+		} else if (name_index_hash[i] == hash) {
+			res = sflash_read(name_index_sadr[i], (uint8_t *)&sflash_info.databuf,
+					  HEADER_SIZE_B + FINFO_SIZE_B);
+			if (res) {
+				return res;
+			}
+			if (sflash_info.databuf.u32[0] != SECTOR_MAGIC_HEAD_ACTIVE) {
+				return JESFS_ERR_INDEX_CORRUPTED;
+			}
+			if (!jesfs_strcmp(pname, (char *)&sflash_info.databuf.u8[HEADER_SIZE_B + 12])) {
+				*psadr = name_index_sadr[i];
+				return 0;
+			}
+		}
+	}
+	return 0;
+}
+#endif
+
+#ifdef JESFS_TAIL_CACHE
+/* End of unclosed files, set by jesfs_write() and by jesfs_read() at EOF. */
+static struct tail_entry {
+	uint32_t head_sadr; /* 0: unused */
+	uint32_t wrk_sadr;
+	uint32_t file_pos;
+	uint16_t sadr_rel;
+} tail_cache[JESFS_TAIL_CACHE];
+static uint8_t tail_cache_next; /* Replaced round robin */
+
+static struct tail_entry *tail_cache_find(uint32_t head_sadr)
+{
+	uint8_t i;
+
+	for (i = 0; i < JESFS_TAIL_CACHE; i++) {
+		if (tail_cache[i].head_sadr == head_sadr) {
+			return &tail_cache[i];
+		}
+	}
+	return NULL;
+}
+
+/* Forget the file head_sadr, 0: all */
+static void tail_cache_drop(uint32_t head_sadr)
+{
+	uint8_t i;
+
+	for (i = 0; i < JESFS_TAIL_CACHE; i++) {
+		if (!head_sadr || tail_cache[i].head_sadr == head_sadr) {
+			tail_cache[i].head_sadr = 0;
+		}
+	}
+}
+
+static void tail_cache_put(const struct jesfs_desc *pdesc)
+{
+	struct tail_entry *pt = tail_cache_find(pdesc->_head_sadr);
+
+	if (!pt) {
+		pt = &tail_cache[tail_cache_next];
+		if (++tail_cache_next >= JESFS_TAIL_CACHE) {
+			tail_cache_next = 0;
+		}
+		pt->head_sadr = pdesc->_head_sadr;
+	}
+	pt->wrk_sadr = pdesc->_wrk_sadr;
+	pt->file_pos = pdesc->file_pos;
+	pt->sadr_rel = pdesc->_sadr_rel;
+}
+
+/*
+ * Move a descriptor (at the start of an unclosed file) to the known end, if
+ * the flash still agrees: last sector of the file and nothing written behind.
+ * Returns 1 if moved.
+ */
+static int16_t tail_cache_seek(struct jesfs_desc *pdesc, uint32_t anz)
+{
+	struct tail_entry *pt = tail_cache_find(pdesc->_head_sadr);
+	uint32_t thdr[3];
+	int16_t res;
+
+	if (!pt || pt->file_pos > anz) {
+		return 0;
+	}
+	res = sflash_read(pt->wrk_sadr, (uint8_t *)thdr, 12);
+	if (res) {
+		return res;
+	}
+	if (pt->wrk_sadr == pdesc->_head_sadr) {
+		res = (thdr[0] != SECTOR_MAGIC_HEAD_ACTIVE || thdr[1] != 0xFFFFFFFF);
+	} else {
+		res = (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != pdesc->_head_sadr);
+	}
+	if (!res && thdr[2] == 0xFFFFFFFF && pt->sadr_rel < SF_SECTOR_PH) {
+		res = sflash_read(pt->wrk_sadr + pt->sadr_rel, (uint8_t *)thdr, 1);
+		if (res) {
+			return res;
+		}
+		res = (*(uint8_t *)thdr != 0xFF);
+	}
+	if (res || thdr[2] != 0xFFFFFFFF) {
+		pt->head_sadr = 0; /* Outdated */
+		return 0;
+	}
+	pdesc->_wrk_sadr = pt->wrk_sadr;
+	pdesc->_next_sadr = 0xFFFFFFFF;
+	pdesc->_sadr_rel = pt->sadr_rel;
+	pdesc->file_pos = pt->file_pos;
+	pdesc->file_len = pt->file_pos;
+	return 1;
+}
+#endif
+
+#ifdef JESFS_WRITE_BUFFER
+/* Write buffers of open files, see jesfs_set_write_buffer() */
+static struct wbuf_entry {
+	struct jesfs_desc *pdesc; /* NULL: unused */
+	uint8_t *pbuf;
+	uint16_t size;
+	uint16_t cnt; /* Buffered, not yet in file_pos */
+} wbuf_tab[JESFS_WRITE_BUFFER];
+
+static struct wbuf_entry *wbuf_find(const struct jesfs_desc *pdesc)
+{
+	uint8_t i;
+
+	for (i = 0; i < JESFS_WRITE_BUFFER; i++) {
+		if (wbuf_tab[i].pdesc == pdesc) {
+			return &wbuf_tab[i];
+		}
+	}
+	return NULL;
+}
+
+/* Forget the buffer of a descriptor (if any), buffered data is lost. */
+static void wbuf_release(const struct jesfs_desc *pdesc)
+{
+	struct wbuf_entry *pw = wbuf_find(pdesc);
+
+	if (pw) {
+		pw->pdesc = NULL;
+	}
+}
+#endif
+
+#ifdef JESFS_SEEK_CACHE
+/* Seek caches of open files, see jesfs_set_seek_cache() */
+static struct seek_entry {
+	const struct jesfs_desc *pdesc; /* NULL: unused */
+	uint32_t head_sadr;		/* File of the cache */
+	uint32_t *pcache;		/* pcache[i]: sector i * step of the file */
+	uint16_t entries;
+	uint16_t cnt; /* Valid from pcache[0] */
+	uint16_t step;
+} seek_tab[JESFS_SEEK_CACHE];
+
+static struct seek_entry *seek_find(const struct jesfs_desc *pdesc)
+{
+	uint8_t i;
+
+	for (i = 0; i < JESFS_SEEK_CACHE; i++) {
+		if (seek_tab[i].pdesc == pdesc) {
+			return &seek_tab[i];
+		}
+	}
+	return NULL;
+}
+
+static void seek_release(const struct jesfs_desc *pdesc)
+{
+	struct seek_entry *ps = seek_find(pdesc);
+
+	if (ps) {
+		ps->pdesc = NULL;
+	}
+}
+
+/* Sector k of the file is at sadr: keep every step-th, halve the table if full. */
+static void seek_cache_put(struct seek_entry *ps, uint32_t k, uint32_t sadr)
+{
+	uint16_t i;
+
+	if (k % ps->step || k / ps->step != ps->cnt) {
+		return;
+	}
+	if (ps->cnt == ps->entries) {
+		for (i = 1; 2 * i < ps->cnt; i++) {
+			ps->pcache[i] = ps->pcache[2 * i];
+		}
+		ps->cnt = (ps->cnt + 1) / 2;
+		ps->step *= 2;
+		if (k % ps->step || k / ps->step != ps->cnt) {
+			return;
+		}
+	}
+	ps->pcache[ps->cnt++] = sadr;
+}
+#endif
+
+#ifdef JESFS_GC
+#ifndef JESFS_GC_POOL
+#define JESFS_GC_POOL 8
+#endif
+/* Erased sectors for the allocator, found by jesfs_gc() */
+static uint32_t gc_pool[JESFS_GC_POOL];
+static uint8_t gc_pool_cnt;
+static uint32_t gc_sadr; /* Scan position */
+static uint8_t gc_todo;	 /* 'To delete' sectors might exist */
+static uint8_t gc_scanned; /* The last full round found nothing new */
+
+static void gc_reset(void)
+{
+	gc_pool_cnt = 0;
+	gc_todo = 1;
+	gc_scanned = 0;
+}
+#endif
+
 static int16_t sflash_sadr_invalid(uint32_t sadr)
 {
 	if (sadr == 0xFFFFFFFF) {
@@ -240,14 +755,110 @@ static int16_t sflash_sadr_invalid(uint32_t sadr)
 	return 0; /* Ok */
 }
 
-static int16_t flash_set2delete(uint32_t sadr)
+/* Used entries of the sector list in the head sadr (written in order). */
+static int16_t head_list_used(uint32_t sadr, uint16_t *pused)
+{
+	uint32_t adr;
+	uint16_t lo = 0;
+	uint16_t hi = HEAD_LIST_L;
+	uint16_t mid;
+	int16_t res;
+
+	/* Search the first free entry */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		res = sflash_read(sadr + HEAD_LIST_OFS + mid * 4, (uint8_t *)&adr, 4);
+		if (res) {
+			return res;
+		}
+		if (adr == 0xFFFFFFFF) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	*pused = lo;
+	return 0;
+}
+
+/*
+ * Ring file (SF_OPEN_RING) with the head sadr: *pfirst gets its oldest data
+ * sector (0xFFFFFFFF: none yet), *pslot the used entries of the start list.
+ * Returns 1: ring file, 0: other file, or an error.
+ */
+static int16_t ring_get(uint32_t sadr, uint32_t *pfirst, uint16_t *pslot)
+{
+	uint32_t adr;
+	uint8_t flags;
+	int16_t res;
+
+	res = sflash_read(sadr + HEADER_SIZE_B + 34, &flags, 1);
+	if (res) {
+		return res;
+	}
+	if (!(flags & SF_OPEN_RING)) {
+		return 0;
+	}
+	res = head_list_used(sadr, pslot);
+	if (res) {
+		return res;
+	}
+	adr = *pslot ? sadr + HEAD_LIST_OFS + (*pslot - 1) * 4 : sadr + 8;
+	res = sflash_read(adr, (uint8_t *)pfirst, 4);
+	if (res) {
+		return res;
+	}
+	return 1;
+}
+
+/* Position a descriptor at the start of a ring file: its oldest data sector. */
+static int16_t ring_rewind(struct jesfs_desc *pdesc)
+{
+	uint32_t first = 0xFFFFFFFF;
+	uint16_t slot;
+	int16_t res;
+
+	res = ring_get(pdesc->_head_sadr, &first, &slot);
+	if (res < 0) {
+		return res;
+	}
+	pdesc->_next_sadr = 0;
+	if (first == 0xFFFFFFFF) {
+		pdesc->_wrk_sadr = pdesc->_head_sadr; /* No data yet, the head is 'full' */
+		pdesc->_sadr_rel = SF_SECTOR_PH;
+		return 0;
+	}
+	if (sflash_sadr_invalid(first)) {
+		return JESFS_ERR_BAD_SECTOR_ADDR;
+	}
+	pdesc->_wrk_sadr = first;
+	pdesc->_sadr_rel = HEADER_SIZE_B;
+	return 0;
+}
+
+/* A data sector of a file is released (marked 'to delete'). */
+static void flash_data_released(uint32_t sadr)
+{
+	sflash_info.available_disk_size += SF_SECTOR_PH;
+#ifdef JESFS_GC
+	gc_todo = 1;
+	gc_scanned = 0;
+#endif
+#ifdef JESFS_FREE_BITMAP
+	free_bitmap_set(sadr);
+#else
+	(void)sadr;
+#endif
+}
+
+/* Delete the sector list at sadr, owned by oadr (the head, sadr itself for files). */
+static int16_t flash_chain2delete(uint32_t sadr, uint32_t oadr)
 {
 	int16_t res;
 	uint32_t thdr[3];
 	uint32_t max_sect;
-	uint32_t oadr;
+	uint16_t slot;
 
-	oadr = sadr;
 	max_sect = (sflash_info.total_flash_size / SF_SECTOR_PH);
 	while (--max_sect) {
 		uint8_t is_head = 0;
@@ -266,6 +877,11 @@ static int16_t flash_set2delete(uint32_t sadr)
 			}
 			thdr[0] = SECTOR_MAGIC_HEAD_DELETED;
 			is_head = 1;
+			/* Ring file: dropped sectors are released already */
+			res = ring_get(sadr, &thdr[2], &slot);
+			if (res < 0) {
+				return res;
+			}
 		} else if (thdr[0] == SECTOR_MAGIC_DATA) {
 			if (thdr[1] != oadr) {
 				return JESFS_ERR_BAD_SECTOR_OWNER;
@@ -281,9 +897,15 @@ static int16_t flash_set2delete(uint32_t sadr)
 		}
 		if (is_head) {
 			sflash_info.files_active--;
+#ifdef JESFS_NAME_INDEX
+			name_index_set(sadr, NAME_HASH_DELETED);
+#endif
+#ifdef JESFS_TAIL_CACHE
+			tail_cache_drop(sadr);
+#endif
 		}
 		if (is_data) {
-			sflash_info.available_disk_size += SF_SECTOR_PH;
+			flash_data_released(sadr);
 		}
 		sadr = thdr[2];
 		if (sadr == 0xFFFFFFFF) {
@@ -293,6 +915,11 @@ static int16_t flash_set2delete(uint32_t sadr)
 	return JESFS_ERR_SECTOR_LIST_CYCLE;
 }
 
+static int16_t flash_set2delete(uint32_t sadr)
+{
+	return flash_chain2delete(sadr, sadr);
+}
+
 /*
  * Find last used byte index in a sector.
  *
@@ -314,6 +941,11 @@ static int32_t sflash_find_mlen(uint32_t sadr, uint16_t max_sec_rd)
 		if (res) {
 			return res;
 		}
+		/* Erased words first (the chunk ends sector aligned) */
+		while (wlen && !(wlen & 3) && sflash_info.databuf.u32[wlen / 4 - 1] == 0xFFFFFFFF) {
+			wlen -= 4;
+			used_len -= 4;
+		}
 		while (wlen--) {
 			if (sflash_info.databuf.u8[wlen] != 0xFF) {
 				return used_len;
@@ -324,6 +956,145 @@ static int32_t sflash_find_mlen(uint32_t sadr, uint16_t max_sec_rd)
 	return 0;
 }
 
+/*
+ * Sector k (0: first data sector) of the record file with the head sadr, from
+ * the sector list in the head, further on along the chain. 0xFFFFFFFF: k is
+ * beyond the end.
+ */
+static int16_t record_sector(uint32_t sadr, uint32_t k, uint32_t *padr)
+{
+	uint32_t thdr[HEADER_SIZE_L];
+	uint32_t adr = 0xFFFFFFFF;
+	uint32_t j = (k > HEAD_LIST_L) ? HEAD_LIST_L : k;
+	int16_t res;
+
+	if (j) {
+		res = sflash_read(sadr + HEAD_LIST_OFS + (j - 1) * 4, (uint8_t *)&adr, 4);
+		if (res) {
+			return res;
+		}
+	}
+	if (adr == 0xFFFFFFFF) {
+		j = 0; /* Not in the list (short file or power fail): from the start */
+		res = sflash_read(sadr + 8, (uint8_t *)&adr, 4);
+		if (res) {
+			return res;
+		}
+	}
+	for (; j < k && adr != 0xFFFFFFFF; j++) {
+		if (sflash_sadr_invalid(adr)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		res = sflash_read(adr, (uint8_t *)thdr, HEADER_SIZE_B);
+		if (res) {
+			return res;
+		}
+		if (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != sadr) {
+			return JESFS_ERR_BAD_SECTOR_OWNER;
+		}
+		adr = thdr[2];
+	}
+	*padr = adr;
+	return 0;
+}
+
+/* Length of the data of a record file (also unclosed), from its last listed sector. */
+static int32_t record_len(uint32_t sadr)
+{
+	uint32_t thdr[HEADER_SIZE_L];
+	uint32_t adr;
+	uint32_t k;
+	uint32_t max_sect;
+	uint16_t used;
+	int32_t mlen;
+	int16_t res;
+
+	res = head_list_used(sadr, &used);
+	if (res) {
+		return res;
+	}
+	k = used;
+	res = sflash_read(used ? sadr + HEAD_LIST_OFS + (used - 1) * 4 : sadr + 8,
+			  (uint8_t *)&adr, 4);
+	if (res) {
+		return res;
+	}
+	if (adr == 0xFFFFFFFF) {
+		return 0; /* No data */
+	}
+	max_sect = (sflash_info.total_flash_size / SF_SECTOR_PH);
+	for (;;) {
+		if (sflash_sadr_invalid(adr)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		res = sflash_read(adr, (uint8_t *)thdr, HEADER_SIZE_B);
+		if (res) {
+			return res;
+		}
+		if (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != sadr) {
+			return JESFS_ERR_BAD_SECTOR_OWNER;
+		}
+		if (thdr[2] == 0xFFFFFFFF) {
+			break;
+		}
+		if (!--max_sect) {
+			return JESFS_ERR_SECTOR_LIST_CYCLE;
+		}
+		adr = thdr[2];
+		k++;
+	}
+	mlen = sflash_find_mlen(adr + HEADER_SIZE_B, DATA_SECT_B);
+	if (mlen < 0) {
+		return mlen;
+	}
+	return k * DATA_SECT_B + mlen;
+}
+
+/* Position a descriptor of a record file at pos (up to the end). */
+static int16_t record_seek(struct jesfs_desc *pdesc, uint32_t pos)
+{
+	uint32_t k = pos / DATA_SECT_B;
+	uint32_t rel = pos % DATA_SECT_B;
+	uint32_t adr;
+	int16_t res;
+
+	if (!rel && k) {
+		k--; /* End of the previous sector */
+		rel = DATA_SECT_B;
+	}
+	res = record_sector(pdesc->_head_sadr, k, &adr);
+	if (res) {
+		return res;
+	}
+	if (adr != 0xFFFFFFFF) {
+		pdesc->_wrk_sadr = adr;
+		pdesc->_sadr_rel = HEADER_SIZE_B + rel;
+	} else if (!pos) {
+		pdesc->_wrk_sadr = pdesc->_head_sadr; /* No data yet, the head is 'full' */
+		pdesc->_sadr_rel = SF_SECTOR_PH;
+	} else {
+		return JESFS_ERR_BAD_FS_STRUCTURE;
+	}
+	pdesc->_next_sadr = 0;
+	pdesc->file_pos = pos;
+	return 0;
+}
+
+/* Length of an open record file, found once for unclosed files. */
+static int32_t record_file_len(struct jesfs_desc *pdesc)
+{
+	int32_t len;
+
+	if (pdesc->file_len == 0xFFFFFFFF) {
+		len = record_len(pdesc->_head_sadr);
+		if (len < 0) {
+			return len;
+		}
+		pdesc->file_len = (uint32_t)len;
+	}
+	return (int32_t)pdesc->file_len;
+}
+
 /* Copy data inside one flash sector while respecting the page-write path. */
 static int16_t flash_intrasec_copy(uint32_t sadr, uint32_t dadr, uint16_t clen)
 {
@@ -350,6 +1121,397 @@ static int16_t flash_intrasec_copy(uint32_t sadr, uint32_t dadr, uint16_t clen)
 	return 0;
 }
 
+#ifdef JESFS_WEAR
+/*
+ * Erase count table (see sflash_wear_count()): a list of DATA sectors, the
+ * first owns itself (like the checkpoint sector). Each save writes a new list
+ * and deletes the old one, so the table wears like data. jesfs_start() finds
+ * it by the scan or by the checkpoint. After the first sector header (u32):
+ *   [0] WEAR_MAGIC  [1] Generation  [2] Flash ID  [3] Sectors  [4] Base
+ *   [5] CRC32 of [1..4] and the counts, written last
+ *   [6..] Count (u16) per sector, continued in the next sectors
+ */
+#define WEAR_MAGIC 0x4145574A /* "JWEA" */
+#define WEAR_HDR_L 6
+#define WEAR_DATA_B (SF_SECTOR_PH - HEADER_SIZE_B)
+#define WEAR_MAX_SECT ((WEAR_HDR_L * 4 + SF_WEAR_SECTORS * 2 + WEAR_DATA_B - 1) / WEAR_DATA_B)
+#define WEAR_MAX_FOUND 4
+#ifndef JESFS_WEAR_SAVE
+#define JESFS_WEAR_SAVE 64
+#endif
+#ifndef JESFS_WEAR_WINDOW
+#define JESFS_WEAR_WINDOW 8
+#endif
+
+static uint32_t wear_sadr;	 /* Table, 0: none */
+static uint32_t wear_generation; /* Of the table */
+static uint32_t wear_id;	 /* Flash of the RAM counts, 0: none */
+static uint32_t wear_found[WEAR_MAX_FOUND]; /* Tables seen by jesfs_start() */
+static uint8_t wear_found_cnt;
+static uint32_t wear_scan_sadr; /* jesfs_wear_level() position */
+
+/*
+ * Check the table at sadr (load: and copy the counts to RAM). Returns 0: OK,
+ * 1: no table here, 2: unusable table, or an error.
+ */
+static int16_t flash_wear_read(uint32_t sadr, uint8_t load, uint32_t *pgen)
+{
+	uint32_t hdr[HEADER_SIZE_L + WEAR_HDR_L];
+	uint32_t thdr[HEADER_SIZE_L];
+	uint32_t nbytes = sflash_info.total_flash_size / SF_SECTOR_PH * 2;
+	uint32_t bpos = 0;
+	uint32_t rel = HEADER_SIZE_B + WEAR_HDR_L * 4;
+	uint32_t blen;
+	uint32_t crc;
+	uint32_t i;
+	int16_t res;
+
+	res = sflash_read(sadr, (uint8_t *)hdr, sizeof(hdr));
+	if (res) {
+		return res;
+	}
+	if (hdr[0] != SECTOR_MAGIC_DATA || hdr[1] != sadr || hdr[3] != WEAR_MAGIC) {
+		return 1;
+	}
+	if (hdr[5] != sflash_info.identification || hdr[6] != nbytes / 2) {
+		return 2;
+	}
+	crc = jesfs_track_crc32((uint8_t *)&hdr[4], 4 * 4, 0xFFFFFFFF);
+	thdr[2] = hdr[2];
+	while (bpos < nbytes) {
+		if (rel == SF_SECTOR_PH) {
+			sadr = thdr[2];
+			if (sadr == 0xFFFFFFFF || sflash_sadr_invalid(sadr)) {
+				return 2;
+			}
+			res = sflash_read(sadr, (uint8_t *)thdr, HEADER_SIZE_B);
+			if (res) {
+				return res;
+			}
+			if (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != hdr[1]) {
+				return 2;
+			}
+			rel = HEADER_SIZE_B;
+		}
+		blen = nbytes - bpos;
+		if (blen > SF_SECTOR_PH - rel) {
+			blen = SF_SECTOR_PH - rel;
+		}
+		if (blen > SF_BUFFER_SIZE_B) {
+			blen = SF_BUFFER_SIZE_B;
+		}
+		res = sflash_read(sadr + rel, (uint8_t *)&sflash_info.databuf, (uint16_t)blen);
+		if (res) {
+			return res;
+		}
+		crc = jesfs_track_crc32(sflash_info.databuf.u8, blen, crc);
+		if (load) {
+			for (i = 0; i < blen; i++) {
+				((uint8_t *)sflash_wear_cnt)[bpos + i] = sflash_info.databuf.u8[i];
+			}
+		}
+		bpos += blen;
+		rel += blen;
+	}
+	if (crc != hdr[8]) {
+		return 2;
+	}
+	if (load) {
+		sflash_wear_base = hdr[7];
+	}
+	*pgen = hdr[4];
+	return 0;
+}
+
+/*
+ * Delete the table at sadr from its end, so the first sector keeps the rest
+ * findable. A table left by a power loss might end early (empty sector).
+ */
+static int16_t flash_wear_delete(uint32_t sadr)
+{
+	uint32_t tab[WEAR_MAX_SECT];
+	uint32_t thdr[HEADER_SIZE_L];
+	uint8_t n;
+	int16_t res;
+
+	for (n = 0; n < WEAR_MAX_SECT && sadr != 0xFFFFFFFF; n++) {
+		if (sflash_sadr_invalid(sadr)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		res = sflash_read(sadr, (uint8_t *)thdr, HEADER_SIZE_B);
+		if (res) {
+			return res;
+		}
+		if (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != (n ? tab[0] : sadr)) {
+			break;
+		}
+		tab[n] = sadr;
+		sadr = thdr[2];
+	}
+	thdr[0] = SECTOR_MAGIC_TODELETE;
+	while (n--) {
+		res = sflash_sector_write(tab[n], (uint8_t *)thdr, 4);
+		if (res) {
+			return res;
+		}
+		sflash_info.available_disk_size += SF_SECTOR_PH;
+		free_bitmap_set(tab[n]);
+#ifdef JESFS_GC
+		gc_todo = 1;
+		gc_scanned = 0;
+#endif
+	}
+	return 0;
+}
+
+/*
+ * Use the newest table found by jesfs_start() and delete the others (left by
+ * a power loss during jesfs_wear_save()). Counts in RAM for the same flash are
+ * newer than any table.
+ */
+static int16_t flash_wear_load(void)
+{
+	uint32_t gen;
+	uint32_t best_gen = 0;
+	uint32_t best = 0;
+	uint8_t i;
+	int16_t res;
+
+	for (i = 0; i < wear_found_cnt; i++) {
+		res = flash_wear_read(wear_found[i], 0, &gen);
+		if (res < 0) {
+			return res;
+		}
+		if (res == 1) {
+			wear_found[i] = 0; /* Not a table (e.g. outdated checkpoint) */
+		} else if (!res && (!best || gen > best_gen)) {
+			best = wear_found[i];
+			best_gen = gen;
+		}
+	}
+	wear_sadr = best;
+	wear_generation = best_gen;
+	if (wear_id != sflash_info.identification) {
+		jesfs_memset((uint8_t *)sflash_wear_cnt, 0, sizeof(sflash_wear_cnt));
+		sflash_wear_base = 0;
+		if (best) {
+			res = flash_wear_read(best, 1, &gen);
+			if (res < 0) {
+				return res;
+			}
+		}
+		wear_id = sflash_info.identification;
+		sflash_wear_changes = 0;
+	}
+	for (i = 0; i < wear_found_cnt; i++) {
+		if (wear_found[i] && wear_found[i] != best) {
+			res = flash_wear_delete(wear_found[i]);
+			if (res) {
+				return res;
+			}
+		}
+	}
+	wear_found_cnt = 0;
+	return 0;
+}
+#endif
+
+#ifdef JESFS_CHECKPOINT
+/*
+ * Mount checkpoint. The last slot of the index (never used for files) points
+ * to the anchor sector, reserved from then on (even with an empty header).
+ * Its header (owner: itself) is written before the slot, older JesFs versions
+ * see an orphaned DATA sector. The anchor lists the checkpoint sectors, the
+ * last valid entry (u32: sector, ~sector) is the current one. Checkpoint
+ * sectors (owner: itself) rotate like data: records are appended until the
+ * sector is full, then a new sector is allocated, the old one deleted and the
+ * new one appended to the anchor. Only a full anchor is erased (every
+ * CKPT_ANCHOR_ENTRIES sectors). Record (u32):
+ *   [0] CKPT_MAGIC  [1] Valid: 0xFFFFFFFF, 0: outdated  [2] Generation
+ *   [3] Flash ID  [4] Creation date  [5] available_disk_size  [6] lusect_adr
+ *   [7] files_used | files_active << 16
+ *   [8] sectors_todelete | sectors_clear << 16 (JSTAT)
+ *   [9] Bitmap words  [10] Erase count table (JESFS_WEAR)
+ *   [11] CRC32 of [2..10] and the bitmap
+ *   [12..] Free sector bitmap (JESFS_FREE_BITMAP)
+ * The CRC is written last. sflash_ckpt_invalidate() clears the valid word
+ * before the first flash modification, so after a power loss the next
+ * jesfs_start() always makes the full scan. Checkpoint sectors not in the
+ * anchor (left by a power loss) are deleted by the scan.
+ */
+#define CKPT_INDEX_SLOT (SF_SECTOR_PH - 4)
+#define CKPT_MAGIC 0x504B434A /* "JCKP" */
+#define CKPT_REC_L 12	      /* Record header (u32) */
+#define CKPT_MAX_BITMAP_WORDS ((1UL << MAX_DENSITY) / SF_SECTOR_PH / 32)
+#define CKPT_ANCHOR_ENTRIES ((SF_SECTOR_PH - HEADER_SIZE_B) / 8)
+#define CKPT_MAX_ORPHANS 4
+
+static uint32_t ckpt_asadr;	 /* Anchor, 0: none */
+static uint16_t ckpt_anext;	 /* Next anchor entry, CKPT_ANCHOR_ENTRIES: erase */
+static uint32_t ckpt_sadr;	 /* Checkpoint sector, 0: none */
+static uint16_t ckpt_next_rel;	 /* Next record, no space: new sector */
+static uint32_t ckpt_generation; /* Of the last record */
+static uint8_t ckpt_clean;	 /* jesfs_start() found no errors */
+static uint32_t ckpt_orphan[CKPT_MAX_ORPHANS]; /* Seen by jesfs_start() */
+static uint8_t ckpt_orphan_cnt;
+
+/* The anchor is not free, even if its header is still empty */
+#define CKPT_RESERVED(sadr) ((sadr) == ckpt_asadr)
+
+static uint16_t ckpt_bitmap_words(void)
+{
+#ifdef JESFS_FREE_BITMAP
+	return (uint16_t)(sflash_info.total_flash_size / SF_SECTOR_PH / 32);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Find anchor and checkpoint sector. Returns the address of the last still
+ * valid record, 0: none
+ */
+static int32_t flash_ckpt_find(void)
+{
+	uint32_t rec[CKPT_REC_L];
+	uint32_t radr = 0;
+	uint16_t lo;
+	uint16_t hi;
+	uint16_t rel;
+	int16_t res;
+
+	ckpt_asadr = 0;
+	ckpt_anext = CKPT_ANCHOR_ENTRIES;
+	ckpt_sadr = 0;
+	ckpt_next_rel = SF_SECTOR_PH;
+	ckpt_generation = 0;
+	res = sflash_read(CKPT_INDEX_SLOT, (uint8_t *)rec, 4);
+	if (res) {
+		return res;
+	}
+	if (rec[0] == 0xFFFFFFFF || sflash_sadr_invalid(rec[0])) {
+		return 0; /* None yet (or unusable) */
+	}
+	ckpt_asadr = rec[0];
+	res = sflash_read(ckpt_asadr, (uint8_t *)rec, HEADER_SIZE_B);
+	if (res) {
+		return res;
+	}
+	if (rec[0] == 0xFFFFFFFF) {
+		return 0; /* Header not yet written: erased by the next checkpoint */
+	}
+	if (rec[0] != SECTOR_MAGIC_DATA || rec[1] != ckpt_asadr) {
+		ckpt_asadr = 0; /* Not ours: never touched, no checkpoints until format */
+		return 0;
+	}
+	/* Entries are appended: the first empty one by bisection */
+	lo = 0;
+	hi = CKPT_ANCHOR_ENTRIES;
+	while (lo < hi) {
+		rel = (lo + hi) / 2;
+		res = sflash_read(ckpt_asadr + HEADER_SIZE_B + rel * 8, (uint8_t *)rec, 4);
+		if (res) {
+			return res;
+		}
+		if (rec[0] == 0xFFFFFFFF) {
+			hi = rel;
+		} else {
+			lo = rel + 1;
+		}
+	}
+	ckpt_anext = lo;
+	if (!lo) {
+		return 0;
+	}
+	res = sflash_read(ckpt_asadr + HEADER_SIZE_B + (lo - 1) * 8, (uint8_t *)rec, 8);
+	if (res) {
+		return res;
+	}
+	if (rec[1] != ~rec[0] || sflash_sadr_invalid(rec[0])) {
+		ckpt_anext = CKPT_ANCHOR_ENTRIES; /* Interrupted entry: erased by the next one */
+		return 0;
+	}
+	res = sflash_read(rec[0], (uint8_t *)&rec[1], HEADER_SIZE_B + 4);
+	if (res) {
+		return res;
+	}
+	if (rec[1] != SECTOR_MAGIC_DATA || rec[2] != rec[0] ||
+	    (rec[4] != CKPT_MAGIC && rec[4] != 0xFFFFFFFF)) {
+		return 0; /* Already deleted for the next one (and maybe reused) */
+	}
+	ckpt_sadr = rec[0];
+	for (rel = HEADER_SIZE_B; rel <= SF_SECTOR_PH - CKPT_REC_L * 4;) {
+		res = sflash_read(ckpt_sadr + rel, (uint8_t *)rec, CKPT_REC_L * 4);
+		if (res) {
+			return res;
+		}
+		if (rec[0] == 0xFFFFFFFF) {
+			ckpt_next_rel = rel;
+			break;
+		}
+		if (rec[0] != CKPT_MAGIC || rec[9] > CKPT_MAX_BITMAP_WORDS) {
+			return 0; /* Corrupted: full, replaced by the next checkpoint */
+		}
+		radr = (rec[1] == 0xFFFFFFFF) ? ckpt_sadr + rel : 0;
+		ckpt_generation = rec[2];
+#ifdef JESFS_WEAR
+		/* Table of the last record, checked by flash_wear_load() */
+		wear_found[0] = rec[10];
+		wear_found_cnt = (rec[10] != 0xFFFFFFFF && !sflash_sadr_invalid(rec[10]));
+#endif
+		rel += CKPT_REC_L * 4 + rec[9] * 4;
+	}
+	return (int32_t)radr;
+}
+#else
+#define CKPT_RESERVED(sadr) 0
+#endif
+
+#ifdef JESFS_CHECKPOINT
+/* Load the state from the record at radr. Returns 0: loaded, 1: not usable, or an error */
+static int16_t flash_ckpt_load(uint32_t radr)
+{
+	uint32_t rec[CKPT_REC_L];
+	uint32_t crc;
+	int16_t res;
+
+	res = sflash_read(radr, (uint8_t *)rec, CKPT_REC_L * 4);
+	if (res) {
+		return res;
+	}
+	if (rec[3] != sflash_info.identification || rec[4] != sflash_info.creation_date ||
+	    rec[9] != ckpt_bitmap_words()) {
+		return 1;
+	}
+	crc = jesfs_track_crc32((uint8_t *)&rec[2], 9 * 4, 0xFFFFFFFF);
+#ifdef JESFS_FREE_BITMAP
+	res = sflash_read(radr + CKPT_REC_L * 4, (uint8_t *)sflash_free_bitmap, rec[9] * 4);
+	if (res) {
+		return res;
+	}
+	crc = jesfs_track_crc32((uint8_t *)sflash_free_bitmap, rec[9] * 4, crc);
+#endif
+	if (crc != rec[11]) {
+		return 1;
+	}
+
+	sflash_info.available_disk_size = rec[5];
+	sflash_info.lusect_adr = rec[6];
+	sflash_info.files_used = (uint16_t)rec[7];
+	sflash_info.files_active = (uint16_t)(rec[7] >> 16);
+#ifdef JSTAT
+	sflash_info.sectors_todelete = (uint16_t)rec[8];
+	sflash_info.sectors_clear = (uint16_t)(rec[8] >> 16);
+	sflash_info.sectors_unknown = 0;
+#endif
+#ifdef JESFS_FREE_BITMAP
+	sflash_free_bitmap_valid = 1;
+#endif
+	sflash_info.ckpt_live_adr = radr;
+	return 0;
+}
+#endif
+
 /* --------------------------- Public JesFs API ---------------------------------------- */
 
 /* Start the filesystem, identify flash, and scan basic on-flash structures. */
@@ -361,6 +1523,9 @@ int16_t jesfs_start(uint8_t mode)
 	uint32_t idx_adr;
 	uint32_t dir_typ;
 	uint16_t err;
+#ifdef JESFS_CHECKPOINT
+	int32_t ckpt_radr;
+#endif
 
 #if !defined(__ZEPHYR__)
 	sflash_spi_init();
@@ -410,6 +1575,21 @@ int16_t jesfs_start(uint8_t mode)
 		return res;
 	}
 
+#ifdef JESFS_NAME_INDEX
+	name_index_valid = 0;
+#endif
+#ifdef JESFS_TAIL_CACHE
+	tail_cache_drop(0); /* Only FS_START_RESTART keeps it */
+#endif
+#ifdef JESFS_WRITE_BUFFER
+	jesfs_memset((uint8_t *)wbuf_tab, 0, sizeof(wbuf_tab)); /* Not if only woken */
+#endif
+#ifdef JESFS_SEEK_CACHE
+	jesfs_memset((uint8_t *)seek_tab, 0, sizeof(seek_tab));
+#endif
+#ifdef JESFS_GC
+	gc_reset();
+#endif
 	/* Flash is known. Read the 12-byte filesystem header. */
 	res = sflash_read(0, (uint8_t *)&sflash_info.databuf, HEADER_SIZE_B);
 	if (res) {
@@ -428,6 +1608,39 @@ int16_t jesfs_start(uint8_t mode)
 
 	sflash_info.creation_date = sflash_info.databuf.u32[2]; /* Must differ from 0xFFFFFFFF. */
 
+#ifdef JESFS_WEAR
+	wear_found_cnt = 0;
+#endif
+#ifdef JESFS_CHECKPOINT
+	ckpt_clean = 0;
+	ckpt_orphan_cnt = 0;
+	sflash_info.ckpt_live_adr = 0;
+	ckpt_radr = flash_ckpt_find();
+	if (ckpt_radr < 0) {
+		return (int16_t)ckpt_radr;
+	}
+	if (ckpt_radr && !(mode & FS_START_FULLSCAN)) {
+		res = flash_ckpt_load((uint32_t)ckpt_radr);
+		if (res <= 0) {
+			ckpt_clean = !res;
+#ifdef JESFS_WEAR
+			if (!res) {
+				res = flash_wear_load();
+			}
+#endif
+			return res; /* Loaded: no scan required */
+		}
+	}
+	if (ckpt_radr) {
+		/* Not used: the scan result might differ */
+		sflash_info.ckpt_live_adr = (uint32_t)ckpt_radr;
+		res = sflash_ckpt_invalidate();
+		if (res) {
+			return res;
+		}
+	}
+#endif
+
 	err = 0;
 	sflash_info.available_disk_size = sflash_info.total_flash_size - SF_SECTOR_PH;
 
@@ -441,6 +1654,15 @@ int16_t jesfs_start(uint8_t mode)
 	sflash_info.files_active = 0;
 
 	sflash_info.lusect_adr = 0;
+#ifdef JESFS_WEAR
+	if (!(mode & FS_START_FAST)) {
+		wear_found_cnt = 0; /* The scan finds all tables */
+	}
+#endif
+#ifdef JESFS_FREE_BITMAP
+	sflash_free_bitmap_valid = 0;
+	jesfs_memset((uint8_t *)sflash_free_bitmap, 0, sizeof(sflash_free_bitmap));
+#endif
 	/* Scan Headers of all sectors (FAST or normal) */
 	/* Scan  Takes on 1M-Flash 12msec, 16M-Flash: 200msec (12 MHz SPI) */
 	for (sadr = SF_SECTOR_PH; sadr < sflash_info.total_flash_size; sadr += SF_SECTOR_PH) {
@@ -451,13 +1673,23 @@ int16_t jesfs_start(uint8_t mode)
 		}
 		switch (sflash_info.databuf.u32[0]) {
 		case 0xFFFFFFFF: /* Empty */
+			if (CKPT_RESERVED(sadr)) {
+				sflash_info.available_disk_size -= SF_SECTOR_PH;
+				break;
+			}
 #ifdef JSTAT
 			sflash_info.sectors_clear++;
+#endif
+#ifdef JESFS_FREE_BITMAP
+			free_bitmap_set(sadr);
 #endif
 			break;
 		case SECTOR_MAGIC_TODELETE:
 #ifdef JSTAT
 			sflash_info.sectors_todelete++;
+#endif
+#ifdef JESFS_FREE_BITMAP
+			free_bitmap_set(sadr);
 #endif
 			sflash_info.lusect_adr = sadr;
 			break;
@@ -505,14 +1737,39 @@ int16_t jesfs_start(uint8_t mode)
 				if (sflash_sadr_invalid(sflash_info.databuf.u32[2])) {
 					err++;
 				}
+#if defined(JESFS_WEAR) || defined(JESFS_CHECKPOINT)
+				/* Owns itself: checkpoint or erase count table */
+				if (idx_adr == sadr && sflash_info.databuf.u32[0] == SECTOR_MAGIC_DATA) {
+					res = sflash_read(sadr + HEADER_SIZE_B, (uint8_t *)&dir_typ, 4);
+					if (res) {
+						return res;
+					}
+#ifdef JESFS_WEAR
+					if (dir_typ == WEAR_MAGIC && wear_found_cnt < WEAR_MAX_FOUND) {
+						wear_found[wear_found_cnt++] = sadr;
+					}
+#endif
+#ifdef JESFS_CHECKPOINT
+					/* Checkpoint sector not in the anchor: power loss while rotating */
+					if ((dir_typ == CKPT_MAGIC || dir_typ == 0xFFFFFFFF) &&
+					    sadr != ckpt_sadr && sadr != ckpt_asadr &&
+					    ckpt_orphan_cnt < CKPT_MAX_ORPHANS) {
+						ckpt_orphan[ckpt_orphan_cnt++] = sadr;
+					}
+#endif
+				}
+#endif
 				break;
 			}
 		}
 	}
+#ifdef JESFS_FREE_BITMAP
+	sflash_free_bitmap_valid = 1; /* Headers known, even if errors were found */
+#endif
 
 	sadr = HEADER_SIZE_B;
 	id = 0;
-	while (sadr != SF_SECTOR_PH) {
+	while (sadr != SF_SECTOR_PH - 4) { /* Last slot: not for files */
 		int16_t res = sflash_read(sadr, (uint8_t *)&idx_adr, 4);
 		if (res) {
 			return res;
@@ -523,12 +1780,22 @@ int16_t jesfs_start(uint8_t mode)
 			if (sflash_sadr_invalid(idx_adr)) {
 				err++;
 			} else {
+#ifdef JESFS_NAME_INDEX
+				/* Same transfer, with the name */
+				res = sflash_read(idx_adr, (uint8_t *)&sflash_info.databuf,
+						  HEADER_SIZE_B + FINFO_SIZE_B);
+				dir_typ = sflash_info.databuf.u32[0];
+#else
 				res = sflash_read(idx_adr, (uint8_t *)&dir_typ, 4);
+#endif
 				if (res) {
 					return res;
 				}
 				if (dir_typ == SECTOR_MAGIC_HEAD_ACTIVE ||
 				    dir_typ == SECTOR_MAGIC_HEAD_DELETED) {
+#ifdef JESFS_NAME_INDEX
+					name_index_put((uint16_t)((sadr - HEADER_SIZE_B) / 4), idx_adr);
+#endif
 					id++;
 				} else {
 					err++;
@@ -538,9 +1805,27 @@ int16_t jesfs_start(uint8_t mode)
 		sadr += 4;
 	}
 
+#ifdef JESFS_WEAR
+	res = flash_wear_load();
+	if (res) {
+		return res;
+	}
+#endif
 	if (err || (uint16_t)id != sflash_info.files_used) {
 		return JESFS_ERR_FS_STRUCTURE_PROBLEM; /* Corrupt Data? */
 	}
+#ifdef JESFS_CHECKPOINT
+	while (ckpt_orphan_cnt) {
+		res = flash_set2delete(ckpt_orphan[--ckpt_orphan_cnt]);
+		if (res) {
+			return res;
+		}
+	}
+	ckpt_clean = 1;
+#endif
+#ifdef JESFS_NAME_INDEX
+	name_index_valid = 1;
+#endif
 	return 0; /* OK */
 }
 
@@ -560,6 +1845,15 @@ int16_t jesfs_deepsleep(void)
 		return JESFS_ERR_DEEPSLEEP_ALREADY; /* Already sleeping, 2.nd command could wake FS
 						       again */
 	}
+#ifdef JESFS_WRITE_BUFFER
+	(void)jesfs_flush(NULL); /* Buffers stay set if FS_START_RESTART only wakes */
+#endif
+#ifdef JESFS_WEAR
+	(void)jesfs_wear_save(JESFS_WEAR_SAVE); /* Before the checkpoint, which points to it */
+#endif
+#ifdef JESFS_CHECKPOINT
+	(void)jesfs_checkpoint(); /* Optional, without: full scan on the next jesfs_start() */
+#endif
 #if !defined(__ZEPHYR__)
 	sflash_info.state_flags |= STATE_DEEPSLEEP;
 	sflash_deep_power_down();
@@ -585,6 +1879,35 @@ int16_t jesfs_deepsleep(void)
  * FS_FORMAT_FULL starts a bulk erase and may take minutes,
  * depending on the flash datasheet.
  */
+/*
+ * Erase the sectors of the 64k block at badr marked in dirty (bit 0: first
+ * sector). Complete 64k or 32k runs use a single block erase.
+ */
+static int16_t flash_erase_dirty(uint32_t badr, uint16_t dirty)
+{
+	uint8_t i;
+	int16_t res;
+
+	if (dirty == 0xFFFF) {
+		return sflash_block_erase(badr, SF_BLOCK_64K);
+	}
+	for (i = 0; i < 16; i++, badr += SF_SECTOR_PH) {
+		if (!(i & 7) && ((dirty >> i) & 0xFF) == 0xFF) {
+			res = sflash_block_erase(badr, SF_BLOCK_32K);
+			i += 7;
+			badr += SF_BLOCK_32K - SF_SECTOR_PH;
+		} else if (dirty & (1 << i)) {
+			res = sflash_sector_erase(badr);
+		} else {
+			continue;
+		}
+		if (res) {
+			return res;
+		}
+	}
+	return 0;
+}
+
 #if !defined(__ZEPHYR__)
 int16_t jesfs_format(uint8_t fmode)
 #else
@@ -595,6 +1918,8 @@ int16_t jesfs_format(uint8_t fmode, void cb_prog(uint32_t cur_sect, uint32_t tot
 	uint32_t sbuf[3];
 	int16_t res;
 	uint32_t sadr;
+	uint16_t dirty = 0;
+	uint8_t trust_empty = 0;
 
 	if (sflash_info.total_flash_size == 0 || sflash_info.identification == 0) {
 		return JESFS_ERR_FLASH_ID_UNKNOWN; /* First jesfs_start() to identify Chip */
@@ -609,6 +1934,44 @@ int16_t jesfs_format(uint8_t fmode, void cb_prog(uint32_t cur_sect, uint32_t tot
 		return JESFS_ERR_VOLTAGE_TOO_LOW; /* Lock Flash Access if power is too low */
 	}
 
+#ifdef JESFS_FREE_BITMAP
+	sflash_free_bitmap_valid = 0; /* Until jesfs_start() */
+#endif
+#ifdef JESFS_NAME_INDEX
+	name_index_valid = 0;
+#endif
+#ifdef JESFS_TAIL_CACHE
+	tail_cache_drop(0);
+#endif
+#ifdef JESFS_WRITE_BUFFER
+	jesfs_memset((uint8_t *)wbuf_tab, 0, sizeof(wbuf_tab));
+#endif
+#ifdef JESFS_SEEK_CACHE
+	jesfs_memset((uint8_t *)seek_tab, 0, sizeof(seek_tab));
+#endif
+#ifdef JESFS_GC
+	gc_reset();
+#endif
+#ifdef JESFS_CHECKPOINT
+	sflash_info.ckpt_live_adr = 0; /* Disk is erased */
+	ckpt_asadr = 0;
+	ckpt_sadr = 0;
+	ckpt_clean = 0;
+#endif
+#ifdef JESFS_WEAR
+	if (wear_id != sflash_info.identification) {
+		jesfs_memset((uint8_t *)sflash_wear_cnt, 0, sizeof(sflash_wear_cnt));
+		sflash_wear_base = 0;
+		wear_id = sflash_info.identification;
+	}
+	wear_sadr = 0; /* The counts in RAM stay */
+#endif
+
+	if (fmode & FS_FORMAT_TRUST_EMPTY) {
+		/* JesFs writes the header first: on a JesFs disk empty headers mean empty sectors */
+		trust_empty = (sflash_info.creation_date != 0xFFFFFFFF);
+		fmode &= ~FS_FORMAT_TRUST_EMPTY;
+	}
 	if (fmode == FS_FORMAT_SOFT) {
 #if defined(__ZEPHYR__)
 		uint32_t total_sect = sflash_info.total_flash_size / SF_SECTOR_PH;
@@ -628,19 +1991,24 @@ int16_t jesfs_format(uint8_t fmode, void cb_prog(uint32_t cur_sect, uint32_t tot
 			}
 #endif
 			/* Header says empty; verify all bytes are really 0xFF. */
-			if (sbuf[0] == 0xFFFFFFFF) {
-				int32_t mlen = sflash_find_mlen(sadr, SF_SECTOR_PH);
-
-				if (mlen < 0) {
-					return (int16_t)mlen;
-				}
-				if (mlen == 0) {
-					continue; /* yes: All empty! No Erase required */
+			res = 1;
+			if (sbuf[0] == 0xFFFFFFFF && sbuf[1] == 0xFFFFFFFF) {
+				res = trust_empty ? 0 : sflash_blank_check(sadr + 8, SF_SECTOR_PH - 8);
+				if (res < 0) {
+					return res;
 				}
 			} /* And all other sectors must be cleared by system */
-			res = sflash_sector_erase(sadr);
 			if (res) {
-				return res;
+				dirty |= (uint16_t)(1 << ((sadr / SF_SECTOR_PH) & 15));
+			}
+			/* End of a 64k block: erase its dirty sectors */
+			if (!((sadr + SF_SECTOR_PH) & (SF_BLOCK_64K - 1)) ||
+			    sadr + SF_SECTOR_PH == sflash_info.total_flash_size) {
+				res = flash_erase_dirty(sadr & ~(SF_BLOCK_64K - 1), dirty);
+				if (res) {
+					return res;
+				}
+				dirty = 0;
 			}
 		}
 #if !defined(__ZEPHYR__)		/* Zephyr has own timing, so we do not need to wait here */
@@ -669,13 +2037,142 @@ int16_t jesfs_format(uint8_t fmode, void cb_prog(uint32_t cur_sect, uint32_t tot
 		return res;
 	}
 
+#ifdef JESFS_WEAR
+	res = jesfs_start(FS_START_NORMAL);
+	if (res) {
+		return res;
+	}
+	return jesfs_wear_save(0); /* The counts survive the format */
+#else
 	return jesfs_start(FS_START_NORMAL);
+#endif
+}
+
+#ifdef JESFS_WEAR
+/* The least erased of JESFS_WEAR_WINDOW free sectors, starting with sadr */
+static uint32_t wear_pick(uint32_t sadr)
+{
+	uint32_t best = sadr;
+	uint32_t nadr = sadr;
+	uint8_t i;
+
+	for (i = 1; i < JESFS_WEAR_WINDOW; i++) {
+		nadr = free_bitmap_next(nadr);
+		if (nadr == sadr) {
+			break; /* Less free sectors */
+		}
+		if (sflash_wear_cnt[nadr / SF_SECTOR_PH] < sflash_wear_cnt[best / SF_SECTOR_PH]) {
+			best = nadr;
+		}
+	}
+	return best;
 }
+#endif
 
-static uint32_t sflash_get_free_sector(void)
+/*
+ * A free sector. prev (0: none) is the last sector of the file: the sector
+ * behind it is preferred if erased, so jesfs_read() reads both in one burst.
+ */
+static uint32_t sflash_get_free_sector(uint32_t prev)
 {
 	uint32_t thdr;
 	uint32_t max_sect;
+
+	if (prev && prev + SF_SECTOR_PH < sflash_info.total_flash_size) {
+		uint32_t sadr = prev + SF_SECTOR_PH;
+		uint8_t take = 1;
+
+#ifdef JESFS_FREE_BITMAP
+		if (sflash_free_bitmap_valid) {
+			take = (sflash_free_bitmap[(sadr / SF_SECTOR_PH) >> 5] >>
+				((sadr / SF_SECTOR_PH) & 31)) & 1;
+#ifdef JESFS_WEAR
+			/* Not if a window of free sectors has a less erased one */
+			thdr = free_bitmap_next(sflash_info.lusect_adr);
+			if (take && thdr &&
+			    sflash_wear_cnt[sadr / SF_SECTOR_PH] >
+				    sflash_wear_cnt[wear_pick(thdr) / SF_SECTOR_PH]) {
+				take = 0;
+			}
+#endif
+		}
+#endif
+		if (take) {
+			if (sflash_read(sadr, (uint8_t *)&thdr, 4)) {
+				return 0;
+			}
+			if (thdr == 0xFFFFFFFF && !CKPT_RESERVED(sadr)) {
+#ifdef JESFS_FREE_BITMAP
+				free_bitmap_clear(sadr);
+#endif
+				sflash_info.lusect_adr = sadr;
+				return sadr;
+			}
+		}
+	}
+#ifdef JESFS_GC
+	while (gc_pool_cnt) {
+		uint32_t sadr;
+#ifdef JESFS_WEAR
+		uint8_t best = gc_pool_cnt - 1;
+		uint8_t i;
+
+		/* The least erased of the pool, not if a window of free sectors has a less erased one */
+		for (i = 0; i < gc_pool_cnt - 1; i++) {
+			if (sflash_wear_cnt[gc_pool[i] / SF_SECTOR_PH] <
+			    sflash_wear_cnt[gc_pool[best] / SF_SECTOR_PH]) {
+				best = i;
+			}
+		}
+		sadr = gc_pool[best];
+		gc_pool[best] = gc_pool[gc_pool_cnt - 1];
+		gc_pool[gc_pool_cnt - 1] = sadr;
+		if (sflash_free_bitmap_valid) {
+			thdr = free_bitmap_next(sflash_info.lusect_adr);
+			if (thdr && sflash_wear_cnt[sadr / SF_SECTOR_PH] >
+					    sflash_wear_cnt[wear_pick(thdr) / SF_SECTOR_PH]) {
+				break; /* Stays erased in the pool */
+			}
+		}
+#endif
+		sadr = gc_pool[--gc_pool_cnt];
+		if (sflash_read(sadr, (uint8_t *)&thdr, 4)) {
+			return 0;
+		}
+		if (thdr != 0xFFFFFFFF || CKPT_RESERVED(sadr)) {
+			continue; /* Allocated meanwhile */
+		}
+#ifdef JESFS_FREE_BITMAP
+		free_bitmap_clear(sadr);
+#endif
+		return sadr;
+	}
+#endif
+#ifdef JESFS_FREE_BITMAP
+	if (sflash_free_bitmap_valid) {
+		uint32_t sadr;
+		while ((sadr = free_bitmap_next(sflash_info.lusect_adr)) != 0) {
+#ifdef JESFS_WEAR
+			sadr = wear_pick(sadr);
+#endif
+			free_bitmap_clear(sadr);
+			sflash_info.lusect_adr = sadr;
+			/* Header decides: erase required? Skip if the bitmap is outdated */
+			if (sflash_read(sadr, (uint8_t *)&thdr, 4)) {
+				return 0;
+			}
+			if (thdr == SECTOR_MAGIC_TODELETE) {
+				if (sflash_sector_erase(sadr)) {
+					return 0;
+				}
+			} else if (thdr != 0xFFFFFFFF) {
+				continue;
+			}
+			return sadr;
+		}
+		return 0;
+	}
+#endif
 	/*
 	 * Some embedded compilers complain about the division. It will result in a
 	 * shift, so the warning can be ignored.
@@ -692,7 +2189,8 @@ static uint32_t sflash_get_free_sector(void)
 		}
 		/* This sector is free if it is marked as 'to delete' or if it is empty (0xFFFFFFFF)
 		 */
-		if (thdr == SECTOR_MAGIC_TODELETE || thdr == 0xFFFFFFFF) {
+		if (thdr == SECTOR_MAGIC_TODELETE ||
+		    (thdr == 0xFFFFFFFF && !CKPT_RESERVED(sflash_info.lusect_adr))) {
 			if (thdr == SECTOR_MAGIC_TODELETE) {
 				if (sflash_sector_erase(sflash_info.lusect_adr)) {
 					return 0;
@@ -704,6 +2202,766 @@ static uint32_t sflash_get_free_sector(void)
 	return 0;
 }
 
+#ifdef JESFS_GC
+/*
+ * Erase up to max_erase 'to delete' sectors (e.g. in idle time) and remember
+ * erased sectors for the allocator. The scan continues with the next call.
+ * Returns the number of erased sectors (0: nothing to do) or an error.
+ * JESFS_ASYNC_ERASE: starts one erase in the background and returns 1, also
+ * while the erase is still running (call again later).
+ */
+int16_t jesfs_gc(uint16_t max_erase)
+{
+	uint32_t thdr;
+	uint32_t nsect;
+	uint32_t esize;
+	uint16_t erased = 0;
+	uint8_t skipped = 0;
+	uint8_t overflow = 0;
+	uint8_t i;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (sflash_info.creation_date == 0xFFFFFFFF) {
+		return JESFS_ERR_BAD_MAGIC; /* Disk not formatted */
+	}
+#ifdef JESFS_ASYNC_ERASE
+	res = sflash_erase_poll();
+	if (res) {
+		return res; /* Still erasing */
+	}
+#endif
+	if (gc_scanned || (!gc_todo && gc_pool_cnt == JESFS_GC_POOL)) {
+		return 0; /* No header read until something is released */
+	}
+	if (jesfs_supply_voltage_check()) {
+		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+		return JESFS_ERR_VOLTAGE_TOO_LOW;
+	}
+
+	/* One round over all sectors (without sector 0) */
+	for (nsect = sflash_info.total_flash_size / SF_SECTOR_PH - 1; nsect; nsect--) {
+		if (erased >= max_erase && gc_pool_cnt == JESFS_GC_POOL) {
+			return erased;
+		}
+		gc_sadr += SF_SECTOR_PH;
+		if (gc_sadr >= sflash_info.total_flash_size) {
+			gc_sadr = SF_SECTOR_PH;
+		}
+#ifdef JESFS_FREE_BITMAP
+		if (sflash_free_bitmap_valid &&
+		    !(sflash_free_bitmap[(gc_sadr / SF_SECTOR_PH) >> 5] &
+		      (1UL << ((gc_sadr / SF_SECTOR_PH) & 31)))) {
+			continue; /* Used */
+		}
+#endif
+		res = sflash_read(gc_sadr, (uint8_t *)&thdr, 4);
+		if (res) {
+			return res;
+		}
+		if (thdr == SECTOR_MAGIC_TODELETE) {
+			if (erased >= max_erase) {
+				skipped = 1;
+				continue;
+			}
+			/* An aligned 64k block of 'to delete' sectors: erase at once */
+			esize = SF_SECTOR_PH;
+			if (!(gc_sadr & (SF_BLOCK_64K - 1)) && nsect >= SF_BLOCK_64K / SF_SECTOR_PH &&
+			    max_erase - erased >= SF_BLOCK_64K / SF_SECTOR_PH) {
+				for (i = 1; i < SF_BLOCK_64K / SF_SECTOR_PH; i++) {
+					res = sflash_read(gc_sadr + i * SF_SECTOR_PH, (uint8_t *)&thdr, 4);
+					if (res) {
+						return res;
+					}
+					if (thdr != SECTOR_MAGIC_TODELETE) {
+						break;
+					}
+				}
+				if (i == SF_BLOCK_64K / SF_SECTOR_PH) {
+					esize = SF_BLOCK_64K;
+				}
+			}
+#ifdef JESFS_ASYNC_ERASE
+			res = sflash_erase_start(gc_sadr, esize);
+#else
+			if (esize == SF_SECTOR_PH) {
+				res = sflash_sector_erase(gc_sadr);
+			} else {
+				res = sflash_block_erase(gc_sadr, esize);
+			}
+#endif
+			if (res) {
+				return res;
+			}
+			erased += esize / SF_SECTOR_PH;
+			gc_sadr += esize - SF_SECTOR_PH;
+			nsect -= esize / SF_SECTOR_PH - 1;
+		} else if (thdr != 0xFFFFFFFF || CKPT_RESERVED(gc_sadr)) {
+			continue;
+		}
+		for (i = 0; i < gc_pool_cnt; i++) {
+			if (gc_pool[i] == gc_sadr) {
+				break;
+			}
+		}
+		if (i == gc_pool_cnt && !CKPT_RESERVED(gc_sadr)) {
+			if (gc_pool_cnt < JESFS_GC_POOL) {
+				gc_pool[gc_pool_cnt++] = gc_sadr;
+			} else {
+				overflow = 1; /* Found again by a later round */
+			}
+		}
+#ifdef JESFS_ASYNC_ERASE
+		if (erased) {
+			return erased; /* One at a time */
+		}
+#endif
+	}
+	if (!skipped) {
+		gc_todo = 0; /* Until the next delete */
+		gc_scanned = !overflow;
+	}
+	return erased;
+}
+#endif
+
+#ifdef JESFS_CHECKPOINT
+/* Append sadr to the anchor, a full anchor is erased first */
+static int16_t flash_ckpt_anchor(uint32_t sadr)
+{
+	uint32_t ent[2];
+	int16_t res;
+
+	if (ckpt_anext >= CKPT_ANCHOR_ENTRIES) {
+		/* Only erase it if it is still ours (or empty) */
+		res = sflash_read(ckpt_asadr, (uint8_t *)ent, 8);
+		if (res) {
+			return res;
+		}
+		if (ent[0] != 0xFFFFFFFF && (ent[0] != SECTOR_MAGIC_DATA || ent[1] != ckpt_asadr)) {
+			ckpt_asadr = 0;
+			return JESFS_ERR_BAD_SECTOR_OWNER;
+		}
+		res = sflash_sector_erase(ckpt_asadr);
+		if (res) {
+			return res;
+		}
+		ent[0] = SECTOR_MAGIC_DATA;
+		ent[1] = ckpt_asadr; /* Owner: itself, 'next' stays unused */
+		res = sflash_sector_write(ckpt_asadr, (uint8_t *)ent, 8);
+		if (res) {
+			return res;
+		}
+		ckpt_anext = 0;
+	}
+	ent[0] = sadr;
+	ent[1] = ~sadr;
+	res = sflash_sector_write(ckpt_asadr + HEADER_SIZE_B + ckpt_anext * 8, (uint8_t *)ent, 8);
+	if (res) {
+		return res;
+	}
+	ckpt_anext++;
+	return 0;
+}
+
+/*
+ * Save the mount state (see flash_ckpt_find()), so the next jesfs_start()
+ * needs no sector scan. Nothing is written if the last checkpoint is still valid.
+ */
+int16_t jesfs_checkpoint(void)
+{
+	uint32_t rec[CKPT_REC_L];
+	uint32_t radr;
+	uint32_t sadr;
+	uint16_t bm_words = ckpt_bitmap_words();
+	uint16_t rel;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (sflash_info.creation_date == 0xFFFFFFFF) {
+		return JESFS_ERR_BAD_MAGIC; /* No disk */
+	}
+	if (!ckpt_clean) {
+		return JESFS_ERR_FS_STRUCTURE_PROBLEM; /* Only a scan without errors is saved */
+	}
+	if (sflash_info.ckpt_live_adr) {
+		return 0; /* Unchanged */
+	}
+	if (jesfs_supply_voltage_check()) {
+		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+		return JESFS_ERR_VOLTAGE_TOO_LOW;
+	}
+
+	if (!ckpt_asadr) {
+		/* First checkpoint on this disk: reserve the anchor */
+		res = sflash_read(CKPT_INDEX_SLOT, (uint8_t *)&radr, 4);
+		if (res) {
+			return res;
+		}
+		if (radr != 0xFFFFFFFF) {
+			return JESFS_ERR_INDEX_FULL; /* Slot not usable */
+		}
+		radr = sflash_get_free_sector(0);
+		if (!radr) {
+			return JESFS_ERR_NO_FREE_SECTOR;
+		}
+		/* Header first: a power loss leaves no slot to a free sector */
+		rec[0] = SECTOR_MAGIC_DATA;
+		rec[1] = radr;
+		res = sflash_sector_write(radr, (uint8_t *)rec, 8);
+		if (res) {
+			return res;
+		}
+		sflash_info.available_disk_size -= SF_SECTOR_PH;
+		res = sflash_sector_write(CKPT_INDEX_SLOT, (uint8_t *)&radr, 4);
+		if (res) {
+			return res;
+		}
+		ckpt_asadr = radr;
+		ckpt_anext = 0;
+		ckpt_sadr = 0;
+	}
+	sadr = ckpt_sadr;
+	rel = ckpt_next_rel;
+	if (!sadr || rel + (CKPT_REC_L + bm_words) * 4 > SF_SECTOR_PH) {
+		/* Full: continue in a new sector, the old one is released like data */
+		if (sadr) {
+			ckpt_sadr = 0;
+			res = flash_set2delete(sadr); /* Only if still owned by itself */
+			if (res) {
+				return res;
+			}
+		}
+		sadr = sflash_get_free_sector(0);
+		if (!sadr) {
+			return JESFS_ERR_NO_FREE_SECTOR;
+		}
+		rec[0] = SECTOR_MAGIC_DATA;
+		rec[1] = sadr; /* Owner: itself, 'next' stays unused */
+		res = sflash_sector_write(sadr, (uint8_t *)rec, 8);
+		if (res) {
+			return res;
+		}
+		sflash_info.available_disk_size -= SF_SECTOR_PH;
+		rel = HEADER_SIZE_B;
+	}
+
+	rec[0] = CKPT_MAGIC;
+	rec[1] = 0xFFFFFFFF;
+	rec[2] = ++ckpt_generation;
+	rec[3] = sflash_info.identification;
+	rec[4] = sflash_info.creation_date;
+	rec[5] = sflash_info.available_disk_size;
+	rec[6] = sflash_info.lusect_adr;
+	rec[7] = sflash_info.files_used | ((uint32_t)sflash_info.files_active << 16);
+#ifdef JSTAT
+	rec[8] = sflash_info.sectors_todelete | ((uint32_t)sflash_info.sectors_clear << 16);
+#else
+	rec[8] = 0xFFFFFFFF;
+#endif
+	rec[9] = bm_words;
+#ifdef JESFS_WEAR
+	rec[10] = wear_sadr ? wear_sadr : 0xFFFFFFFF;
+#else
+	rec[10] = 0xFFFFFFFF;
+#endif
+	rec[11] = jesfs_track_crc32((uint8_t *)&rec[2], 9 * 4, 0xFFFFFFFF);
+#ifdef JESFS_FREE_BITMAP
+	rec[11] = jesfs_track_crc32((uint8_t *)sflash_free_bitmap, bm_words * 4, rec[11]);
+#endif
+
+	radr = sadr + rel;
+	res = sflash_sector_write(radr, (uint8_t *)rec, 11 * 4);
+	if (res) {
+		return res;
+	}
+#ifdef JESFS_FREE_BITMAP
+	res = sflash_sector_write(radr + CKPT_REC_L * 4, (uint8_t *)sflash_free_bitmap,
+				  bm_words * 4);
+	if (res) {
+		return res;
+	}
+#endif
+	res = sflash_sector_write(radr + 11 * 4, (uint8_t *)&rec[11], 4); /* Valid from now */
+	if (res) {
+		return res;
+	}
+	if (sadr != ckpt_sadr) {
+		res = flash_ckpt_anchor(sadr); /* New sector: only with its entry */
+		if (res) {
+			return res;
+		}
+		ckpt_sadr = sadr;
+	}
+	ckpt_next_rel = rel + (CKPT_REC_L + bm_words) * 4;
+	sflash_info.ckpt_live_adr = radr;
+	return 0;
+}
+#endif
+
+#ifdef JESFS_WEAR
+/* Statistics of the erase counts. */
+int16_t jesfs_wear_stat(struct jesfs_wear_stat *pws)
+{
+	uint32_t nsect = sflash_info.total_flash_size / SF_SECTOR_PH;
+	uint32_t sum = 0;
+	uint32_t sect;
+	uint16_t cnt;
+
+	if (nsect < 2) {
+		return JESFS_ERR_BAD_MAGIC; /* No disk */
+	}
+	pws->min = 0xFFFF;
+	pws->max = 0;
+	for (sect = 1; sect < nsect; sect++) {
+		cnt = sflash_wear_cnt[sect];
+		sum += cnt;
+		if (cnt < pws->min) {
+			pws->min = cnt;
+			pws->min_sadr = sect * SF_SECTOR_PH;
+		}
+		if (cnt >= pws->max && (cnt > pws->max || !pws->max_sadr)) {
+			pws->max = cnt;
+			pws->max_sadr = sect * SF_SECTOR_PH;
+		}
+	}
+	pws->mean = sflash_wear_base + sum / (nsect - 1);
+	pws->min += sflash_wear_base;
+	pws->max += sflash_wear_base;
+	pws->unsaved = sflash_wear_changes;
+	return 0;
+}
+
+/*
+ * Write the erase counts to a new table (see flash_wear_read()), then delete
+ * the old one. The headers come first (the first with the magic): a table
+ * left by a power loss is found and deleted by jesfs_start().
+ */
+int16_t jesfs_wear_save(uint16_t min_changes)
+{
+	uint32_t tab[WEAR_MAX_SECT] = { 0 };
+	uint32_t hdr[HEADER_SIZE_L + WEAR_HDR_L];
+	uint32_t nbytes = sflash_info.total_flash_size / SF_SECTOR_PH * 2;
+	uint32_t bpos = 0;
+	uint32_t rel = HEADER_SIZE_B + WEAR_HDR_L * 4;
+	uint32_t blen;
+	uint32_t old;
+	uint8_t tsect;
+	uint8_t i;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (sflash_info.creation_date == 0xFFFFFFFF) {
+		return JESFS_ERR_BAD_MAGIC; /* No disk */
+	}
+	if (wear_sadr && sflash_wear_changes < min_changes) {
+		return 0;
+	}
+	if (jesfs_supply_voltage_check()) {
+		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+		return JESFS_ERR_VOLTAGE_TOO_LOW;
+	}
+
+	tsect = (uint8_t)((WEAR_HDR_L * 4 + nbytes + WEAR_DATA_B - 1) / WEAR_DATA_B);
+	for (i = 0; i < tsect; i++) {
+		tab[i] = sflash_get_free_sector(0); /* Might erase: all before the counts */
+		if (!tab[i]) {
+			while (i--) {
+				free_bitmap_set(tab[i]); /* Still empty */
+			}
+			return JESFS_ERR_NO_FREE_SECTOR;
+		}
+	}
+	hdr[3] = WEAR_MAGIC;
+	hdr[4] = ++wear_generation;
+	hdr[5] = sflash_info.identification;
+	hdr[6] = nbytes / 2;
+	hdr[7] = sflash_wear_base;
+	hdr[8] = jesfs_track_crc32((uint8_t *)&hdr[4], 4 * 4, 0xFFFFFFFF);
+	hdr[8] = jesfs_track_crc32((uint8_t *)sflash_wear_cnt, nbytes, hdr[8]);
+	for (i = 0; i < tsect; i++) {
+		hdr[0] = SECTOR_MAGIC_DATA;
+		hdr[1] = tab[0];
+		hdr[2] = (i + 1 < tsect) ? tab[i + 1] : 0xFFFFFFFF;
+		res = sflash_sector_write(tab[i], (uint8_t *)hdr,
+					  i ? HEADER_SIZE_B : HEADER_SIZE_B + 5 * 4);
+		if (res) {
+			return res;
+		}
+		sflash_info.available_disk_size -= SF_SECTOR_PH;
+	}
+	for (i = 0; bpos < nbytes; i++) {
+		blen = nbytes - bpos;
+		if (blen > SF_SECTOR_PH - rel) {
+			blen = SF_SECTOR_PH - rel;
+		}
+		res = sflash_sector_write(tab[i] + rel, (uint8_t *)sflash_wear_cnt + bpos, blen);
+		if (res) {
+			return res;
+		}
+		bpos += blen;
+		rel = HEADER_SIZE_B;
+	}
+	res = sflash_sector_write(tab[0] + HEADER_SIZE_B + 5 * 4, (uint8_t *)&hdr[8], 4);
+	if (res) {
+		return res;
+	}
+
+	old = wear_sadr;
+	wear_sadr = tab[0];
+	sflash_wear_changes = 0;
+	if (old) {
+		return flash_wear_delete(old);
+	}
+	return 0;
+}
+
+/* Reuse the least erased head of a deleted file (*psfun_adr: one of them). */
+static int16_t wear_head_pick(uint32_t *psfun_adr)
+{
+	uint32_t sadr;
+#ifndef JESFS_NAME_INDEX
+	uint32_t magic;
+	int16_t res;
+#endif
+	uint16_t i;
+
+	for (i = 0; i < sflash_info.files_used; i++) {
+#ifdef JESFS_NAME_INDEX
+		if (name_index_hash[i] != NAME_HASH_DELETED) {
+			continue;
+		}
+		sadr = name_index_sadr[i];
+#else
+		res = sflash_read(HEADER_SIZE_B + i * 4, (uint8_t *)&sadr, 4);
+		if (!res) {
+			res = sflash_read(sadr, (uint8_t *)&magic, 4);
+		}
+		if (res) {
+			return res;
+		}
+		if (magic != SECTOR_MAGIC_HEAD_DELETED) {
+			continue;
+		}
+#endif
+		if (sflash_wear_cnt[sadr / SF_SECTOR_PH] < sflash_wear_cnt[*psfun_adr / SF_SECTOR_PH]) {
+			*psfun_adr = sadr;
+		}
+	}
+	return 0;
+}
+
+/* Free sector (number) with the most erases, 0: none */
+static uint32_t wear_free_worn(void)
+{
+	uint32_t nsect = sflash_info.total_flash_size / SF_SECTOR_PH;
+	uint32_t best = 0;
+	uint32_t sect;
+
+	for (sect = 1; sect < nsect; sect++) {
+		if ((sflash_free_bitmap[sect >> 5] & (1UL << (sect & 31))) &&
+		    (!best || sflash_wear_cnt[sect] > sflash_wear_cnt[best])) {
+			best = sect;
+		}
+	}
+	return best;
+}
+
+/* Allocate the free sector with the most erases (for static data), 0: none */
+static uint32_t wear_take_worn(void)
+{
+	uint32_t sadr;
+	uint32_t thdr;
+
+	while ((sadr = wear_free_worn() * SF_SECTOR_PH) != 0) {
+		free_bitmap_clear(sadr);
+		if (sflash_read(sadr, (uint8_t *)&thdr, 4)) {
+			return 0;
+		}
+		if (thdr == SECTOR_MAGIC_TODELETE) {
+			if (sflash_sector_erase(sadr)) {
+				return 0;
+			}
+		} else if (thdr != 0xFFFFFFFF) {
+			continue; /* Bitmap outdated */
+		}
+		sflash_info.available_disk_size -= SF_SECTOR_PH;
+		return sadr;
+	}
+	return 0;
+}
+
+/*
+ * Move the data sectors of the closed file (head sadr, length flen) to worn
+ * free sectors. The head is rewritten (via a temporary copy) to link them.
+ * Returns 1: moved, 0: not moved (head only or too large for the free
+ * sectors), or an error.
+ */
+static int16_t flash_wear_move(uint32_t sadr, uint32_t flen)
+{
+	uint32_t thdr[HEADER_SIZE_L];
+	uint32_t hcap = SF_SECTOR_PH - HEADER_SIZE_B - FINFO_SIZE_B;
+	uint32_t first;
+	uint32_t src;
+	uint32_t dst;
+	uint32_t tmp;
+	uint32_t next;
+	int32_t mlen;
+	int16_t res;
+
+	if (flen <= hcap) {
+		return 0; /* Head only: not moved */
+	}
+	/* The new sectors and the copy of the head */
+	if (sflash_info.available_disk_size <
+	    ((flen - hcap + WEAR_DATA_B - 1) / WEAR_DATA_B + 1) * SF_SECTOR_PH) {
+		return 0; /* Not now */
+	}
+	res = sflash_read(sadr, (uint8_t *)thdr, HEADER_SIZE_B);
+	if (res) {
+		return res;
+	}
+	first = thdr[2];
+	dst = wear_take_worn();
+	tmp = dst; /* First of the new list */
+	src = first;
+	while (src != 0xFFFFFFFF) {
+		if (!dst) {
+			return JESFS_ERR_NO_FREE_SECTOR;
+		}
+		if (sflash_sadr_invalid(src)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		res = sflash_read(src, (uint8_t *)thdr, HEADER_SIZE_B);
+		if (res) {
+			return res;
+		}
+		if (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != sadr) {
+			return JESFS_ERR_BAD_SECTOR_OWNER;
+		}
+		next = thdr[2];
+		mlen = WEAR_DATA_B;
+		if (next == 0xFFFFFFFF) {
+			mlen = sflash_find_mlen(src + HEADER_SIZE_B, WEAR_DATA_B);
+			if (mlen < 0) {
+				return (int16_t)mlen;
+			}
+		} else {
+			thdr[2] = wear_take_worn();
+			if (!thdr[2]) {
+				return JESFS_ERR_NO_FREE_SECTOR;
+			}
+		}
+		res = sflash_sector_write(dst, (uint8_t *)thdr, HEADER_SIZE_B);
+		if (!res) {
+			res = flash_intrasec_copy(src + HEADER_SIZE_B, dst + HEADER_SIZE_B,
+						  (uint16_t)mlen);
+		}
+		if (res) {
+			return res;
+		}
+		src = next;
+		dst = thdr[2];
+	}
+
+	/* Rewrite the head: temporary copy (owned by the file) */
+	src = tmp;
+	tmp = wear_take_worn();
+	if (!tmp) {
+		return JESFS_ERR_NO_FREE_SECTOR;
+	}
+	thdr[0] = SECTOR_MAGIC_DATA;
+	thdr[1] = sadr;
+	thdr[2] = 0xFFFFFFFF;
+	res = sflash_sector_write(tmp, (uint8_t *)thdr, HEADER_SIZE_B);
+	if (!res) {
+		res = flash_intrasec_copy(sadr + HEADER_SIZE_B, tmp + HEADER_SIZE_B, WEAR_DATA_B);
+	}
+	if (!res) {
+		res = sflash_sector_erase(sadr);
+	}
+	if (!res) {
+		thdr[0] = SECTOR_MAGIC_HEAD_ACTIVE;
+		thdr[1] = 0xFFFFFFFF;
+		thdr[2] = src;
+		res = sflash_sector_write(sadr, (uint8_t *)thdr, HEADER_SIZE_B);
+	}
+	if (!res) {
+		res = flash_intrasec_copy(tmp + HEADER_SIZE_B, sadr + HEADER_SIZE_B, WEAR_DATA_B);
+	}
+	if (!res) {
+		res = flash_chain2delete(tmp, sadr);
+	}
+	if (!res) {
+		res = flash_chain2delete(first, sadr);
+	}
+#ifdef JESFS_TAIL_CACHE
+	tail_cache_drop(sadr);
+#endif
+	return res ? res : 1;
+}
+
+/*
+ * Static wear leveling: sectors of unchanged files keep low erase counts.
+ * Moving these files to the most erased free sectors gives the low counts to
+ * new data. Heads stay (the index points to them).
+ */
+int16_t jesfs_wear_level(uint16_t max_files, uint16_t min_spread)
+{
+	uint32_t hdr[HEADER_SIZE_L + 1];
+	uint32_t head;
+	uint32_t sect;
+	uint32_t n;
+	uint32_t worn; /* Most erased free sector, 0: none */
+	uint8_t ftype[2];
+	int16_t moved = 0;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (sflash_info.creation_date == 0xFFFFFFFF || !sflash_free_bitmap_valid) {
+		return JESFS_ERR_BAD_MAGIC; /* No disk */
+	}
+	if (jesfs_supply_voltage_check()) {
+		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+		return JESFS_ERR_VOLTAGE_TOO_LOW;
+	}
+
+	worn = wear_free_worn();
+	for (n = sflash_info.total_flash_size / SF_SECTOR_PH - 1; worn && n && moved < max_files;
+	     n--) {
+		wear_scan_sadr += SF_SECTOR_PH;
+		if (wear_scan_sadr >= sflash_info.total_flash_size) {
+			wear_scan_sadr = SF_SECTOR_PH;
+		}
+		sect = wear_scan_sadr / SF_SECTOR_PH;
+		if ((sflash_free_bitmap[sect >> 5] & (1UL << (sect & 31))) ||
+		    (uint32_t)sflash_wear_cnt[sect] + min_spread > sflash_wear_cnt[worn]) {
+			continue; /* Free or not cold */
+		}
+		res = sflash_read(wear_scan_sadr, (uint8_t *)hdr, HEADER_SIZE_B);
+		if (res) {
+			return res;
+		}
+		if (hdr[0] == SECTOR_MAGIC_DATA && hdr[1] != wear_scan_sadr) {
+			head = hdr[1];
+		} else if (hdr[0] == SECTOR_MAGIC_HEAD_ACTIVE) {
+			head = wear_scan_sadr;
+		} else {
+			continue; /* E.g. checkpoint or erase count table */
+		}
+		if (sflash_sadr_invalid(head)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		res = sflash_read(head, (uint8_t *)hdr, HEADER_SIZE_B + 4);
+		if (res) {
+			return res;
+		}
+		if (hdr[0] != SECTOR_MAGIC_HEAD_ACTIVE || hdr[HEADER_SIZE_L] == 0xFFFFFFFF) {
+			continue; /* Deleted or unclosed */
+		}
+		res = sflash_read(head + FINFO_TYPE_OFS - 1, ftype, 2); /* Flags and type */
+		if (res) {
+			return res;
+		}
+		if ((ftype[0] & SF_OPEN_RING) || ftype[1] == FTYPE_RECORD) {
+			continue; /* Ring or record file: its head lists the sectors */
+		}
+		res = flash_wear_move(head, hdr[HEADER_SIZE_L]);
+		if (res < 0) {
+			return res;
+		}
+		if (res) {
+			moved++;
+			worn = wear_free_worn();
+		}
+	}
+	return moved;
+}
+#endif
+
+#ifndef SF_RD_TRANSFER_LIMIT
+/*
+ * jesfs_read() over physically consecutive sectors: one sflash_read() of the
+ * rest of the current sector and the following sectors (with their headers)
+ * into pdest. The headers are checked and removed, the burst stops at a
+ * sector that does not follow (jesfs_read() continues there).
+ * Returns the number of bytes read or an error.
+ */
+static int32_t read_burst(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t anz)
+{
+	uint32_t hdr[HEADER_SIZE_L];
+	uint32_t sadr = pdesc->_wrk_sadr;
+	uint32_t next = pdesc->_next_sadr;
+	uint32_t src = SF_SECTOR_PH - pdesc->_sadr_rel; /* Rest of the current sector */
+	uint32_t dst = src;
+	uint32_t n;
+	int16_t res;
+
+	if (pdesc->file_len != 0xFFFFFFFF && anz > pdesc->file_len - pdesc->file_pos) {
+		anz = pdesc->file_len - pdesc->file_pos;
+	}
+	if (anz > sflash_info.total_flash_size - (sadr + pdesc->_sadr_rel)) {
+		anz = sflash_info.total_flash_size - (sadr + pdesc->_sadr_rel);
+	}
+	if (anz > 0xFFFF) {
+		anz = 0xFFFF; /* sflash_read() */
+	}
+	if (anz <= src + HEADER_SIZE_B) {
+		return 0;
+	}
+	res = sflash_read(sadr + pdesc->_sadr_rel, pdest, (uint16_t)anz);
+	if (res) {
+		return res;
+	}
+	pdesc->_sadr_rel = SF_SECTOR_PH;
+	while (next == sadr + SF_SECTOR_PH && src + HEADER_SIZE_B < anz) {
+		for (n = 0; n < HEADER_SIZE_B; n++) {
+			((uint8_t *)hdr)[n] = pdest[src + n];
+		}
+		if (hdr[0] != SECTOR_MAGIC_DATA || hdr[1] != pdesc->_head_sadr ||
+		    sflash_sadr_invalid(hdr[2])) {
+			break; /* Reported by jesfs_read() */
+		}
+		src += HEADER_SIZE_B;
+		n = anz - src;
+		if (n > DATA_SECT_B) {
+			n = DATA_SECT_B;
+		}
+		if (hdr[2] == 0xFFFFFFFF && pdesc->file_len == 0xFFFFFFFF) {
+			/* Last sector of an unclosed file: used up to the last non-0xFF */
+			if (n < DATA_SECT_B) {
+				break;
+			}
+			while (n && pdest[src + n - 1] == 0xFF) {
+				n--;
+			}
+			pdesc->file_len = pdesc->file_pos + dst + n;
+		}
+		sadr = next;
+		next = hdr[2];
+		pdesc->_wrk_sadr = sadr;
+		pdesc->_next_sadr = next;
+		pdesc->_sadr_rel = HEADER_SIZE_B + n;
+		while (n--) {
+			pdest[dst++] = pdest[src++];
+		}
+	}
+	if (pdesc->open_flags & SF_OPEN_CRC) {
+		pdesc->file_crc32 = jesfs_track_crc32(pdest, dst, pdesc->file_crc32);
+	}
+	pdesc->file_pos += dst;
+	return (int32_t)dst;
+}
+#endif
+
 /* --- jesfs_read() --- */
 int32_t jesfs_read(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t anz)
 {
@@ -724,29 +2982,66 @@ int32_t jesfs_read(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t anz)
 		return JESFS_ERR_BAD_FILE_FLAGS;
 	}
 
-	while (anz) {
-		int16_t res = sflash_read(pdesc->_wrk_sadr, (uint8_t *)&sflash_info.databuf,
-					  HEADER_SIZE_B + FINFO_SIZE_B);
-		if (res) {
+#ifdef JESFS_TAIL_CACHE
+	if (!pdest && !pdesc->file_pos && pdesc->file_len == 0xFFFFFFFF) {
+		int16_t res = tail_cache_seek(pdesc, anz);
+
+		if (res < 0) {
 			return res;
 		}
-		h = sflash_info.databuf.u32[0];
-		if (h == SECTOR_MAGIC_HEAD_ACTIVE) {
-			if (sflash_info.databuf.u32[1] != 0xFFFFFFFF) {
-				return JESFS_ERR_SECTOR_HEADER_OWNER;
+		if (res) {
+			total_rd = (int32_t)pdesc->file_pos;
+			anz -= pdesc->file_pos;
+		}
+	}
+#endif
+
+	while (anz) {
+		/* Header only once per sector, the link is kept in the descriptor */
+		next_sect = pdesc->_next_sadr;
+		if (!next_sect) {
+			int16_t res = sflash_read(pdesc->_wrk_sadr, (uint8_t *)&sflash_info.databuf,
+						  HEADER_SIZE_B + FINFO_SIZE_B);
+			if (res) {
+				return res;
+			}
+			h = sflash_info.databuf.u32[0];
+			if (h == SECTOR_MAGIC_HEAD_ACTIVE) {
+				if (sflash_info.databuf.u32[1] != 0xFFFFFFFF) {
+					return JESFS_ERR_SECTOR_HEADER_OWNER;
+				}
+			} else if (h == SECTOR_MAGIC_DATA) {
+				if (sflash_info.databuf.u32[1] != pdesc->_head_sadr) {
+					return JESFS_ERR_BAD_SECTOR_OWNER;
+				}
+			} else {
+				return JESFS_ERR_BAD_SECTOR_TYPE;
+			}
+
+			next_sect = sflash_info.databuf.u32[2];
+			if (sflash_sadr_invalid(next_sect)) {
+				return JESFS_ERR_BAD_SECTOR_ADDR;
+			}
+			pdesc->_next_sadr = next_sect;
+		}
+
+#ifndef SF_RD_TRANSFER_LIMIT
+		if (pdest && next_sect == pdesc->_wrk_sadr + SF_SECTOR_PH &&
+		    pdesc->_sadr_rel < SF_SECTOR_PH &&
+		    !(pdesc->_prealloc && pdesc->file_len == 0xFFFFFFFF)) {
+			int32_t res = read_burst(pdesc, pdest, anz);
+
+			if (res < 0) {
+				return res;
 			}
-		} else if (h == SECTOR_MAGIC_DATA) {
-			if (sflash_info.databuf.u32[1] != pdesc->_head_sadr) {
-				return JESFS_ERR_BAD_SECTOR_OWNER;
+			if (res) {
+				pdest += res;
+				anz -= res;
+				total_rd += res;
+				continue;
 			}
-		} else {
-			return JESFS_ERR_BAD_SECTOR_TYPE;
-		}
-
-		next_sect = sflash_info.databuf.u32[2];
-		if (sflash_sadr_invalid(next_sect)) {
-			return JESFS_ERR_BAD_SECTOR_ADDR;
 		}
+#endif
 
 		while (anz) {
 			max_sec_rd = (SF_SECTOR_PH - pdesc->_sadr_rel);
@@ -760,17 +3055,27 @@ int32_t jesfs_read(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t anz)
 					anz = h;
 				}
 
-			} else if (next_sect == 0xFFFFFFFF) {
-				int32_t mlen = sflash_find_mlen(pdesc->_wrk_sadr + pdesc->_sadr_rel,
-								max_sec_rd);
+			} else if (next_sect == 0xFFFFFFFF || pdesc->_prealloc) {
+				int32_t mlen = 0;
 
-				if (mlen < 0) {
-					return mlen;
+				if (next_sect != 0xFFFFFFFF) {
+					/* Preallocated: the end is before the first linked sector still blank */
+					mlen = sflash_blank_check(next_sect + HEADER_SIZE_B, DATA_SECT_B);
+					if (mlen < 0) {
+						return mlen;
+					}
 				}
-				pdesc->file_len =
-					pdesc->file_pos + (uint32_t)mlen; /* Now we know the End */
-				if (anz > (uint32_t)mlen) {
-					anz = (uint32_t)mlen;
+				if (!mlen) {
+					mlen = sflash_find_mlen(pdesc->_wrk_sadr + pdesc->_sadr_rel,
+								max_sec_rd);
+					if (mlen < 0) {
+						return mlen;
+					}
+					pdesc->file_len = pdesc->file_pos +
+							  (uint32_t)mlen; /* Now we know the End */
+					if (anz > (uint32_t)mlen) {
+						anz = (uint32_t)mlen;
+					}
 				}
 			}
 
@@ -804,6 +3109,7 @@ int32_t jesfs_read(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t anz)
 			if (pdesc->_sadr_rel == SF_SECTOR_PH) {
 				if (next_sect != 0xFFFFFFFF) {
 					pdesc->_wrk_sadr = next_sect;
+					pdesc->_next_sadr = 0;
 					pdesc->_sadr_rel = HEADER_SIZE_B;
 				} else {
 					if (anz) {
@@ -814,9 +3120,47 @@ int32_t jesfs_read(struct jesfs_desc *pdesc, uint8_t *pdest, uint32_t anz)
 			}
 		}
 	}
+#ifdef JESFS_TAIL_CACHE
+	if ((pdesc->open_flags & SF_XOPEN_UNCLOSED) && pdesc->file_pos == pdesc->file_len) {
+		tail_cache_put(pdesc); /* EOF */
+	}
+#endif
 	return total_rd; /* max 2GB */
 }
 
+int32_t jesfs_read_stream(struct jesfs_desc *pdesc, uint32_t len,
+			  int16_t cb_chunk(void *ctx, const uint8_t *pdata, uint16_t clen),
+			  void *ctx)
+{
+	int32_t total_rd = 0;
+	int32_t res;
+	uint16_t clen;
+
+	while (len) {
+		clen = SF_BUFFER_SIZE_B;
+		if (pdesc->_sadr_rel < SF_SECTOR_PH &&
+		    clen > SF_SECTOR_PH - pdesc->_sadr_rel) {
+			clen = SF_SECTOR_PH - pdesc->_sadr_rel; /* One SPI read per chunk */
+		}
+		if (clen > len) {
+			clen = (uint16_t)len;
+		}
+		res = jesfs_read(pdesc, (uint8_t *)&sflash_info.databuf, clen);
+		if (res <= 0) {
+			return res ? res : total_rd; /* Error or end of file */
+		}
+		total_rd += res;
+		len -= res;
+		if (cb_chunk) {
+			res = cb_chunk(ctx, sflash_info.databuf.u8, (uint16_t)res);
+			if (res) {
+				return (res < 0) ? res : total_rd;
+			}
+		}
+	}
+	return total_rd;
+}
+
 /* Rewind File to Start */
 int16_t jesfs_rewind(struct jesfs_desc *pdesc)
 {
@@ -827,11 +3171,166 @@ int16_t jesfs_rewind(struct jesfs_desc *pdesc)
 		return JESFS_ERR_NOT_OPEN_FOR_WRITE;
 	}
 	pdesc->_wrk_sadr = pdesc->_head_sadr;
+	pdesc->_next_sadr = 0;
 	pdesc->file_pos = 0;
 	pdesc->_sadr_rel = HEADER_SIZE_B + FINFO_SIZE_B;
 	pdesc->file_crc32 = 0xFFFFFFFF; /* Reset CRC */
+	if (pdesc->open_flags & SF_OPEN_RING) {
+		return ring_rewind(pdesc);
+	}
+	if (pdesc->_rec_size) {
+		return record_seek(pdesc, 0);
+	}
+	return 0;
+}
+
+int32_t jesfs_seek(struct jesfs_desc *pdesc, uint32_t pos)
+{
+	uint32_t k; /* Sector of pos, 0: head */
+	uint32_t kw;
+	uint32_t sadr;
+	uint32_t next;
+	int32_t res;
+#ifdef JESFS_SEEK_CACHE
+	struct seek_entry *ps;
+#endif
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (!pdesc->_head_sadr) {
+		return JESFS_ERR_BAD_DESCRIPTOR;
+	}
+	if (!(pdesc->open_flags & (SF_OPEN_READ | SF_OPEN_RAW))) {
+		return JESFS_ERR_BAD_FILE_FLAGS;
+	}
+	if (pdesc->_prealloc && pdesc->file_len == 0xFFFFFFFF) {
+		/* Links beyond the end: find the end first */
+		res = jesfs_read(pdesc, NULL, 0xFFFFFFFF);
+		if (res < 0) {
+			return res;
+		}
+	}
+	if (pdesc->file_len != 0xFFFFFFFF && pos > pdesc->file_len) {
+		pos = pdesc->file_len;
+	}
+	if (pdesc->_rec_size) {
+		res = record_file_len(pdesc);
+		if (res < 0) {
+			return res;
+		}
+		if (pos > (uint32_t)res) {
+			pos = (uint32_t)res;
+		}
+		res = record_seek(pdesc, pos);
+		return res ? res : (int32_t)pos;
+	}
+	if (pdesc->open_flags & SF_OPEN_RING) {
+		/* The start moves with each drop */
+		if (pos < pdesc->file_pos) {
+			res = jesfs_rewind(pdesc);
+			if (res) {
+				return res;
+			}
+		}
+		res = jesfs_read(pdesc, NULL, pos - pdesc->file_pos);
+		return (res < 0) ? res : (int32_t)pdesc->file_pos;
+	}
+
+	k = (pos < HEAD_DATA_B) ? 0 : 1 + (pos - HEAD_DATA_B) / DATA_SECT_B;
+	kw = 0;
+	sadr = pdesc->_head_sadr;
+	if (pdesc->_wrk_sadr != pdesc->_head_sadr) {
+		/* Start of the current sector */
+		next = pdesc->file_pos + HEADER_SIZE_B - pdesc->_sadr_rel;
+		if (1 + (next - HEAD_DATA_B) / DATA_SECT_B <= k) {
+			kw = 1 + (next - HEAD_DATA_B) / DATA_SECT_B;
+			sadr = pdesc->_wrk_sadr;
+		}
+	}
+#ifdef JESFS_SEEK_CACHE
+	ps = seek_find(pdesc);
+	if (ps && ps->head_sadr == pdesc->_head_sadr) {
+		next = k / ps->step;
+		if (next >= ps->cnt) {
+			next = ps->cnt - 1;
+		}
+		if (next * ps->step > kw) {
+			kw = next * ps->step;
+			sadr = ps->pcache[next];
+		}
+	} else {
+		ps = NULL;
+	}
+#endif
+	while (kw < k) {
+		res = sflash_read(sadr + 8, (uint8_t *)&next, 4);
+		if (res) {
+			return res;
+		}
+		if (next == 0xFFFFFFFF) {
+			break; /* Last sector */
+		}
+		if (sflash_sadr_invalid(next)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		sadr = next;
+		kw++;
+#ifdef JESFS_SEEK_CACHE
+		if (ps) {
+			seek_cache_put(ps, kw, sadr);
+		}
+#endif
+	}
+	if (sadr != pdesc->_wrk_sadr) {
+		pdesc->_wrk_sadr = sadr;
+		pdesc->_next_sadr = 0;
+	}
+	pdesc->_sadr_rel = kw ? HEADER_SIZE_B : HEADER_SIZE_B + FINFO_SIZE_B;
+	pdesc->file_pos = kw ? HEAD_DATA_B + (kw - 1) * DATA_SECT_B : 0;
+	res = jesfs_read(pdesc, NULL, pos - pdesc->file_pos);
+	return (res < 0) ? res : (int32_t)pdesc->file_pos;
+}
+
+#ifdef JESFS_SEEK_CACHE
+int16_t jesfs_set_seek_cache(struct jesfs_desc *pdesc, uint32_t *pcache, uint16_t entries)
+{
+	struct seek_entry *ps;
+	uint32_t nsect;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (!pdesc->_head_sadr) {
+		return JESFS_ERR_BAD_DESCRIPTOR;
+	}
+	seek_release(pdesc);
+	if (!pcache || !entries) {
+		return 0;
+	}
+	if (!(pdesc->open_flags & (SF_OPEN_READ | SF_OPEN_RAW)) ||
+	    (pdesc->open_flags & SF_OPEN_RING) || pdesc->_rec_size) {
+		return JESFS_ERR_BAD_FILE_FLAGS;
+	}
+	ps = seek_find(NULL);
+	if (!ps) {
+		return JESFS_ERR_NO_SEEK_CACHE_SLOT;
+	}
+	ps->pdesc = pdesc;
+	ps->head_sadr = pdesc->_head_sadr;
+	ps->pcache = pcache;
+	ps->entries = entries;
+	ps->pcache[0] = pdesc->_head_sadr;
+	ps->cnt = 1;
+	ps->step = 1;
+	if (pdesc->file_len != 0xFFFFFFFF) {
+		/* Known size: the step for the whole file */
+		nsect = 1 + pdesc->file_len / DATA_SECT_B;
+		ps->step = (uint16_t)((nsect + entries - 1) / entries);
+	}
 	return 0;
 }
+#endif
 
 /*
  * Open a file. With SF_OPEN_CREATE, create a new file and delete any existing
@@ -848,7 +3347,23 @@ int16_t jesfs_open(struct jesfs_desc *pdesc, const char *pname, uint8_t flags)
 	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
 		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
 	}
+#ifdef JESFS_WRITE_BUFFER
+	if (wbuf_find(pdesc)) {
+		/* Reused without jesfs_close() */
+		res = jesfs_flush(pdesc);
+		wbuf_release(pdesc);
+		if (res) {
+			return res;
+		}
+	}
+#endif
+#ifdef JESFS_SEEK_CACHE
+	seek_release(pdesc);
+#endif
 	pdesc->_head_sadr = 0;
+	pdesc->_next_sadr = 0;
+	pdesc->_rec_size = 0;
+	pdesc->_prealloc = 0;
 	pdesc->file_crc32 = 0xFFFFFFFF;
 	if (sflash_info.creation_date == 0xFFFFFFFF) {
 		return JESFS_ERR_BAD_MAGIC; /* Disk not formatted */
@@ -865,6 +3380,12 @@ int16_t jesfs_open(struct jesfs_desc *pdesc, const char *pname, uint8_t flags)
 		return JESFS_ERR_BAD_FILENAME;
 	}
 
+#ifdef JESFS_NAME_INDEX
+	res = name_index_find(pname, &sadr, &sfun_adr);
+	if (res) {
+		return res;
+	}
+#else
 	for (i = 0; i < sflash_info.files_used; i++) {
 		int16_t res;
 		res = sflash_read(HEADER_SIZE_B + i * 4, (uint8_t *)&sadr, 4);
@@ -886,6 +3407,7 @@ int16_t jesfs_open(struct jesfs_desc *pdesc, const char *pname, uint8_t flags)
 		}
 		sadr = 0;
 	}
+#endif
 	pdesc->open_flags = flags;
 	pdesc->_sadr_rel = HEADER_SIZE_B + FINFO_SIZE_B;
 	pdesc->file_pos = 0;
@@ -904,12 +3426,28 @@ int16_t jesfs_open(struct jesfs_desc *pdesc, const char *pname, uint8_t flags)
 			pdesc->file_len = sflash_info.databuf.u32[HEADER_SIZE_L + 0];
 			if (pdesc->file_len == 0xFFFFFFFF) {
 				pdesc->open_flags |= SF_XOPEN_UNCLOSED;
+				pdesc->_prealloc =
+					(sflash_info.databuf.u8[FINFO_TYPE_OFS] == FTYPE_PREALLOC);
 			}
+			pdesc->open_flags &= ~SF_OPEN_RING;
 			pdesc->open_flags |= (sflash_info.databuf.u8[HEADER_SIZE_B + 34] &
-					      (SF_OPEN_EXT_SYNC | _SF_OPEN_RES));
+					      (SF_OPEN_EXT_SYNC | SF_OPEN_RING));
 			pdesc->file_ctime =
 				sflash_info.databuf
 					.u32[HEADER_SIZE_L + 2]; /* get file creation time */
+			if (pdesc->open_flags & SF_OPEN_RING) {
+				return ring_rewind(pdesc);
+			}
+			if (sflash_info.databuf.u8[FINFO_TYPE_OFS] == FTYPE_RECORD) {
+				uint32_t rec_size;
+
+				res = sflash_read(sadr + HEAD_PARAM_OFS, (uint8_t *)&rec_size, 4);
+				if (res) {
+					return res;
+				}
+				pdesc->_rec_size = (uint16_t)rec_size;
+				return record_seek(pdesc, 0);
+			}
 			return 0;
 		}
 		if (!(flags & SF_OPEN_CREATE)) {
@@ -931,91 +3469,362 @@ int16_t jesfs_open(struct jesfs_desc *pdesc, const char *pname, uint8_t flags)
 		return JESFS_ERR_VOLTAGE_TOO_LOW; /* Lock Flash Access if power is too low */
 	}
 
+#ifdef JESFS_WEAR
+	if (sfun_adr) {
+		res = wear_head_pick(&sfun_adr);
+		if (res) {
+			return res;
+		}
+	}
+#endif
 	if (!sfun_adr) {
-		sfun_adr = sflash_get_free_sector();
+		sfun_adr = sflash_get_free_sector(0);
 		if (!sfun_adr) {
 			return JESFS_ERR_NO_FREE_SECTOR;
 		}
 		if (HEADER_SIZE_B + sflash_info.files_used * 4 >= (SF_SECTOR_PH - 4)) {
 			return JESFS_ERR_INDEX_FULL;
 		}
-		res = sflash_sector_write(HEADER_SIZE_B + sflash_info.files_used * 4,
-					  (uint8_t *)&sfun_adr, 4);
+		res = sflash_sector_write(HEADER_SIZE_B + sflash_info.files_used * 4,
+					  (uint8_t *)&sfun_adr, 4);
+		if (res) {
+			return res;
+		}
+		new_index_entry = 1;
+	} else {
+		res = sflash_sector_erase(sfun_adr);
+		if (res) {
+			return res;
+		}
+	}
+
+	jesfs_memset((uint8_t *)&sflash_info.databuf, 0xFF, HEADER_SIZE_B + FINFO_SIZE_B);
+	sflash_info.databuf.u32[0] = SECTOR_MAGIC_HEAD_ACTIVE;
+	jesfs_strncpy((char *)&sflash_info.databuf.u8[HEADER_SIZE_B + 12], pname, FNAMELEN);
+	pdesc->file_ctime = jesfs_get_secs();
+	sflash_info.databuf.u32[HEADER_SIZE_L + 2] = pdesc->file_ctime;
+	sflash_info.databuf.u8[HEADER_SIZE_B + 34] = flags;
+	res = sflash_sector_write(sfun_adr, (uint8_t *)&sflash_info.databuf,
+				  HEADER_SIZE_B + FINFO_SIZE_B);
+	if (res) {
+		return res;
+	}
+
+	pdesc->_head_sadr = sfun_adr;
+	pdesc->_wrk_sadr = sfun_adr;
+	pdesc->_next_sadr = 0xFFFFFFFF;
+	if (flags & SF_OPEN_RING) {
+		pdesc->_sadr_rel = SF_SECTOR_PH; /* Data only in the following sectors */
+	}
+
+	if (new_index_entry) {
+#ifdef JESFS_NAME_INDEX
+		name_index_sadr[sflash_info.files_used] = sfun_adr;
+		name_index_hash[sflash_info.files_used] = name_hash(pname);
+#endif
+		sflash_info.available_disk_size -= SF_SECTOR_PH;
+		sflash_info.files_used++;
+	}
+#ifdef JESFS_NAME_INDEX
+	else {
+		name_index_set(sfun_adr, name_hash(pname));
+	}
+#endif
+	sflash_info.files_active++;
+	return 0;
+}
+
+int16_t jesfs_open_ring(struct jesfs_desc *pdesc, const char *pname, uint8_t flags,
+			uint32_t max_len)
+{
+	uint32_t nsect;
+	int16_t res;
+
+	if (flags & SF_OPEN_CRC) {
+		return JESFS_ERR_BAD_FILE_FLAGS; /* Dropped data is not in the CRC */
+	}
+	res = jesfs_open(pdesc, pname, flags | SF_OPEN_CREATE | SF_OPEN_RING);
+	if (res) {
+		return res;
+	}
+	if (!(pdesc->open_flags & SF_OPEN_RING)) {
+		return JESFS_ERR_BAD_FILE_FLAGS; /* SF_OPEN_RAW: existing other file */
+	}
+	res = sflash_read(pdesc->_head_sadr + HEAD_PARAM_OFS, (uint8_t *)&nsect, 4);
+	if (res || nsect != 0xFFFFFFFF) {
+		return res; /* Limit set at creation */
+	}
+	nsect = (max_len + DATA_SECT_B - 1) / DATA_SECT_B + 1;
+	if (nsect < 2) {
+		nsect = 2;
+	}
+	return sflash_sector_write(pdesc->_head_sadr + HEAD_PARAM_OFS, (uint8_t *)&nsect, 4);
+}
+
+int16_t jesfs_open_record(struct jesfs_desc *pdesc, const char *pname, uint8_t flags,
+			  uint16_t rec_size)
+{
+	static const uint8_t ffpad[16] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+					   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	uint32_t hinfo[2];
+	int32_t len;
+	uint16_t wlen;
+	int16_t res;
+
+	if (!rec_size) {
+		return JESFS_ERR_BAD_RECORD_SIZE;
+	}
+	if (flags & (SF_OPEN_RING | SF_OPEN_CRC)) {
+		return JESFS_ERR_BAD_FILE_FLAGS; /* No CRC: a RAW reopen appends */
+	}
+	res = jesfs_open(pdesc, pname, flags | SF_OPEN_CREATE);
+	if (res) {
+		return res;
+	}
+	if (pdesc->_rec_size) {
+		/* SF_OPEN_RAW: continue at the end */
+		if (pdesc->_rec_size != rec_size) {
+			return JESFS_ERR_BAD_RECORD_SIZE;
+		}
+		len = (int32_t)pdesc->file_len;
+		if (pdesc->file_len == 0xFFFFFFFF) {
+			len = record_len(pdesc->_head_sadr);
+			if (len < 0) {
+				return (int16_t)len;
+			}
+		}
+		res = record_seek(pdesc, (uint32_t)len);
+		pdesc->file_len = pdesc->file_pos;
+		while (!res && (pdesc->file_pos % rec_size)) {
+			wlen = rec_size - pdesc->file_pos % rec_size;
+			if (wlen > sizeof(ffpad)) {
+				wlen = sizeof(ffpad);
+			}
+			res = jesfs_write(pdesc, ffpad, wlen);
+		}
+		return res;
+	}
+	res = sflash_read(pdesc->_head_sadr + HEADER_SIZE_B, (uint8_t *)hinfo, 4);
+	if (!res) {
+		res = sflash_read(pdesc->_head_sadr + HEAD_PARAM_OFS, (uint8_t *)&hinfo[1], 4);
+	}
+	if (res) {
+		return res;
+	}
+	if (pdesc->file_len || hinfo[0] != 0xFFFFFFFF || hinfo[1] != 0xFFFFFFFF) {
+		return JESFS_ERR_BAD_FILE_FLAGS; /* SF_OPEN_RAW: existing other file */
+	}
+	/* The type marks a valid size */
+	hinfo[1] = rec_size;
+	res = sflash_sector_write(pdesc->_head_sadr + HEAD_PARAM_OFS, (uint8_t *)&hinfo[1], 4);
+	if (!res) {
+		res = sflash_sector_write(pdesc->_head_sadr + FINFO_TYPE_OFS,
+					  (const uint8_t *)"\xFE", 1);
+	}
+	pdesc->_rec_size = rec_size;
+	pdesc->_sadr_rel = SF_SECTOR_PH; /* Data only in the following sectors */
+	return res;
+}
+
+int16_t jesfs_append_record(struct jesfs_desc *pdesc, const uint8_t *prec)
+{
+	if (!pdesc->_rec_size) {
+		return JESFS_ERR_BAD_FILE_FLAGS;
+	}
+	return jesfs_write(pdesc, prec, pdesc->_rec_size);
+}
+
+int32_t jesfs_record_count(struct jesfs_desc *pdesc)
+{
+	int32_t len;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (!pdesc->_head_sadr) {
+		return JESFS_ERR_BAD_DESCRIPTOR;
+	}
+	if (!pdesc->_rec_size) {
+		return JESFS_ERR_BAD_FILE_FLAGS;
+	}
+	len = record_file_len(pdesc);
+	if (len < 0) {
+		return len;
+	}
+	/* A record cut by a power fail counts (the rest reads as 0xFF) */
+	return ((uint32_t)len + pdesc->_rec_size - 1) / pdesc->_rec_size;
+}
+
+int32_t jesfs_read_record(struct jesfs_desc *pdesc, uint32_t n, uint8_t *pdest)
+{
+	int32_t res;
+
+	res = jesfs_record_count(pdesc);
+	if (res < 0) {
+		return res;
+	}
+	if (n >= (uint32_t)res) {
+		return 0;
+	}
+	if (!(pdesc->open_flags & (SF_OPEN_READ | SF_OPEN_RAW))) {
+		return JESFS_ERR_BAD_FILE_FLAGS;
+	}
+	res = record_seek(pdesc, n * pdesc->_rec_size);
+	if (res) {
+		return res;
+	}
+	res = jesfs_read(pdesc, pdest, pdesc->_rec_size);
+	if (res >= 0 && res < pdesc->_rec_size) {
+		jesfs_memset(pdest + res, 0xFF, pdesc->_rec_size - res);
+		res = pdesc->_rec_size;
+	}
+	return res;
+}
+
+/* Return 0 if the file exists, otherwise a negative JesFs error. */
+int16_t jesfs_notexists(const char *pname)
+{
+	struct jesfs_desc fs_desc_test;
+	return jesfs_open(&fs_desc_test, pname, SF_OPEN_READ);
+}
+
+/*
+ * A ring file needs a new sector: at its limit the oldest data sector is
+ * dropped. Its successor is added to the start list in the head, then the
+ * sector is released (a sector left from a power fail in between is released
+ * with the next drop). A full start list is reset by rewriting the head, like
+ * jesfs_rename() does.
+ */
+static int16_t ring_drop(struct jesfs_desc *pdesc)
+{
+	uint32_t head = pdesc->_head_sadr;
+	uint32_t thdr[HEADER_SIZE_L];
+	uint32_t nsect;
+	uint32_t first;
+	uint32_t prev;
+	uint16_t slot = 0;
+	int16_t res;
+
+	res = sflash_read(head + HEAD_PARAM_OFS, (uint8_t *)&nsect, 4);
+	if (res) {
+		return res;
+	}
+	if (pdesc->file_pos / DATA_SECT_B < nsect) {
+		return 0; /* Not full (or no limit set) */
+	}
+	res = ring_get(head, &first, &slot);
+	if (res <= 0) {
+		return res;
+	}
+	if (sflash_sadr_invalid(first)) {
+		return JESFS_ERR_BAD_SECTOR_ADDR;
+	}
+	if (slot) {
+		/* The sector of the last drop */
+		prev = (slot > 1) ? head + HEAD_LIST_OFS + (slot - 2) * 4 : head + 8;
+		res = sflash_read(prev, (uint8_t *)&prev, 4);
+		if (!res && !sflash_sadr_invalid(prev)) {
+			res = sflash_read(prev, (uint8_t *)thdr, HEADER_SIZE_B);
+			if (!res && thdr[0] == SECTOR_MAGIC_DATA && thdr[1] == head &&
+			    thdr[2] == first) {
+				thdr[0] = SECTOR_MAGIC_TODELETE;
+				res = sflash_sector_write(prev, (uint8_t *)thdr, 4);
+				if (!res) {
+					flash_data_released(prev);
+				}
+			}
+		}
+		if (res) {
+			return res;
+		}
+	}
+	res = sflash_read(first, (uint8_t *)thdr, HEADER_SIZE_B);
+	if (res) {
+		return res;
+	}
+	if (thdr[0] != SECTOR_MAGIC_DATA || thdr[1] != head) {
+		return JESFS_ERR_BAD_SECTOR_OWNER;
+	}
+	if (sflash_sadr_invalid(thdr[2])) {
+		return JESFS_ERR_BAD_FS_STRUCTURE; /* No successor */
+	}
+	if (slot == HEAD_LIST_L) {
+		res = sflash_read(head, (uint8_t *)&sflash_info.databuf, HEAD_LIST_OFS);
+		if (!res) {
+			res = sflash_sector_erase(head);
+		}
 		if (res) {
 			return res;
 		}
-		new_index_entry = 1;
-	} else {
-		res = sflash_sector_erase(sfun_adr);
+		sflash_info.databuf.u32[2] = first;
+		res = sflash_sector_write(head, (uint8_t *)&sflash_info.databuf, HEAD_LIST_OFS);
 		if (res) {
 			return res;
 		}
+		slot = 0;
 	}
-
-	jesfs_memset((uint8_t *)&sflash_info.databuf, 0xFF, HEADER_SIZE_B + FINFO_SIZE_B);
-	sflash_info.databuf.u32[0] = SECTOR_MAGIC_HEAD_ACTIVE;
-	jesfs_strncpy((char *)&sflash_info.databuf.u8[HEADER_SIZE_B + 12], pname, FNAMELEN);
-	pdesc->file_ctime = jesfs_get_secs();
-	sflash_info.databuf.u32[HEADER_SIZE_L + 2] = pdesc->file_ctime;
-	sflash_info.databuf.u8[HEADER_SIZE_B + 34] = flags;
-	res = sflash_sector_write(sfun_adr, (uint8_t *)&sflash_info.databuf,
-				  HEADER_SIZE_B + FINFO_SIZE_B);
+	res = sflash_sector_write(head + HEAD_LIST_OFS + slot * 4, (uint8_t *)&thdr[2], 4);
 	if (res) {
 		return res;
 	}
-
-	pdesc->_head_sadr = sfun_adr;
-	pdesc->_wrk_sadr = sfun_adr;
-
-	if (new_index_entry) {
-		sflash_info.available_disk_size -= SF_SECTOR_PH;
-		sflash_info.files_used++;
+	thdr[0] = SECTOR_MAGIC_TODELETE;
+	res = sflash_sector_write(first, (uint8_t *)thdr, 4);
+	if (res) {
+		return res;
+	}
+	flash_data_released(first);
+	pdesc->file_pos -= DATA_SECT_B;
+	if (pdesc->file_len != 0xFFFFFFFF) {
+		pdesc->file_len -= DATA_SECT_B;
 	}
-	sflash_info.files_active++;
 	return 0;
 }
 
-/* Return 0 if the file exists, otherwise a negative JesFs error. */
-int16_t jesfs_notexists(const char *pname)
-{
-	struct jesfs_desc fs_desc_test;
-	return jesfs_open(&fs_desc_test, pname, SF_OPEN_READ);
-}
-
-/* Append/write data to an opened file descriptor. */
-int16_t jesfs_write(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len)
+/* Append len bytes at the current end of the file on the flash. */
+static int16_t flash_write_data(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len)
 {
 	int16_t res;
 	uint32_t maxwrite;
 	uint32_t wlen;
 	uint32_t newsect;
 
-	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
-		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
-	}
-	if (!pdesc->_head_sadr) {
-		return JESFS_ERR_BAD_DESCRIPTOR;
-	}
-	if (pdesc->open_flags & SF_OPEN_RAW) {
-		if (pdesc->file_pos != pdesc->file_len) {
-			return JESFS_ERR_RAW_WRITE_UNKNOWN_END;
-		}
-	} else if (!(pdesc->open_flags & SF_OPEN_WRITE)) {
-		return JESFS_ERR_NOT_OPEN_FOR_WRITE;
-	}
-
-	if (jesfs_supply_voltage_check()) {
-		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
-		return JESFS_ERR_VOLTAGE_TOO_LOW; /* Lock Flash Access if power is too low */
-	}
-
 	while (len) {
 		maxwrite = SF_SECTOR_PH - pdesc->_sadr_rel;
 		if (maxwrite > SF_SECTOR_PH) {
 			return JESFS_ERR_SECTOR_BORDER_VIOLATED;
 		}
 		if (!maxwrite) {
-			newsect = sflash_get_free_sector();
+			newsect = 0xFFFFFFFF;
+			if (!(pdesc->open_flags & SF_OPEN_RING) && !pdesc->_rec_size) {
+				newsect = pdesc->_next_sadr;
+				if (!newsect) { /* Unknown after jesfs_read() (SF_OPEN_RAW) */
+					res = sflash_read(pdesc->_wrk_sadr + 8, (uint8_t *)&newsect,
+							  4);
+					if (res) {
+						return res;
+					}
+				}
+			}
+			if (newsect != 0xFFFFFFFF) {
+				/* Preallocated (jesfs_preallocate()): header and link are set */
+				if (sflash_sadr_invalid(newsect)) {
+					return JESFS_ERR_BAD_SECTOR_ADDR;
+				}
+				res = sflash_read(newsect + 8, (uint8_t *)&pdesc->_next_sadr, 4);
+				if (res) {
+					return res;
+				}
+				pdesc->_wrk_sadr = newsect;
+				pdesc->_sadr_rel = HEADER_SIZE_B;
+				continue;
+			}
+			if (pdesc->open_flags & SF_OPEN_RING) {
+				res = ring_drop(pdesc);
+				if (res) {
+					return res;
+				}
+			}
+			newsect = sflash_get_free_sector(pdesc->_wrk_sadr);
 			if (!newsect) {
 				return JESFS_ERR_NO_FREE_SECTOR;
 			}
@@ -1026,6 +3835,7 @@ int16_t jesfs_write(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len
 			}
 
 			pdesc->_wrk_sadr = newsect;
+			pdesc->_next_sadr = 0xFFFFFFFF;
 			pdesc->_sadr_rel = HEADER_SIZE_B;
 			maxwrite = SF_SECTOR_PH - HEADER_SIZE_B;
 			sflash_info.databuf.u32[0] = SECTOR_MAGIC_DATA;
@@ -1036,6 +3846,15 @@ int16_t jesfs_write(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len
 				return res;
 			}
 			sflash_info.available_disk_size -= SF_SECTOR_PH;
+			wlen = pdesc->file_pos / DATA_SECT_B; /* No data in the head */
+			if (pdesc->_rec_size && wlen && wlen <= HEAD_LIST_L) {
+				res = sflash_sector_write(pdesc->_head_sadr + HEAD_LIST_OFS +
+								  (wlen - 1) * 4,
+							  (uint8_t *)&newsect, 4);
+				if (res) {
+					return res;
+				}
+			}
 		}
 
 		wlen = len;
@@ -1060,6 +3879,262 @@ int16_t jesfs_write(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len
 	return 0;
 }
 
+#ifdef JESFS_WRITE_BUFFER
+/* Collect data up to the end of the flash page, full pages go directly. */
+static int16_t wbuf_write(struct wbuf_entry *pw, const uint8_t *pdata, uint32_t len)
+{
+	struct jesfs_desc *pdesc = pw->pdesc;
+	uint16_t room;
+	uint16_t cnt;
+	int16_t res;
+
+	while (len) {
+		if (pdesc->_sadr_rel == SF_SECTOR_PH) {
+			room = 256 - HEADER_SIZE_B; /* First page of the next sector */
+		} else {
+			room = 256 - (pdesc->_sadr_rel & 255);
+		}
+		if (room > pw->size) {
+			room = pw->size;
+		}
+		if (!pw->cnt && len >= room) {
+			res = flash_write_data(pdesc, pdata, room);
+			if (res) {
+				return res;
+			}
+			pdata += room;
+			len -= room;
+			continue;
+		}
+		while (len && pw->cnt < room) {
+			pw->pbuf[pw->cnt++] = *pdata++;
+			len--;
+		}
+		if (pw->cnt == room) {
+			cnt = pw->cnt;
+			pw->cnt = 0;
+			res = flash_write_data(pdesc, pw->pbuf, cnt);
+			if (res) {
+				return res;
+			}
+		}
+	}
+	return 0;
+}
+#endif
+
+int16_t jesfs_write(struct jesfs_desc *pdesc, const uint8_t *pdata, uint32_t len)
+{
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (!pdesc->_head_sadr) {
+		return JESFS_ERR_BAD_DESCRIPTOR;
+	}
+	if (pdesc->open_flags & SF_OPEN_RAW) {
+		if (pdesc->file_pos != pdesc->file_len) {
+			return JESFS_ERR_RAW_WRITE_UNKNOWN_END;
+		}
+	} else if (!(pdesc->open_flags & SF_OPEN_WRITE)) {
+		return JESFS_ERR_NOT_OPEN_FOR_WRITE;
+	}
+
+	if (jesfs_supply_voltage_check()) {
+		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+		return JESFS_ERR_VOLTAGE_TOO_LOW; /* Lock Flash Access if power is too low */
+	}
+
+#ifdef JESFS_WRITE_BUFFER
+	struct wbuf_entry *pw = wbuf_find(pdesc);
+
+	if (pw) {
+		res = wbuf_write(pw, pdata, len);
+	} else {
+		res = flash_write_data(pdesc, pdata, len);
+	}
+#else
+	res = flash_write_data(pdesc, pdata, len);
+#endif
+	if (res) {
+		return res;
+	}
+#ifdef JESFS_TAIL_CACHE
+	tail_cache_put(pdesc);
+#endif
+	return 0;
+}
+
+int16_t jesfs_preallocate(struct jesfs_desc *pdesc, uint32_t len)
+{
+	uint32_t sadr;
+	uint32_t next;
+	uint32_t room;
+	uint32_t nsect;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (!pdesc->_head_sadr) {
+		return JESFS_ERR_BAD_DESCRIPTOR;
+	}
+	if (pdesc->open_flags & SF_OPEN_RAW) {
+		if (pdesc->file_pos != pdesc->file_len) {
+			return JESFS_ERR_RAW_WRITE_UNKNOWN_END;
+		}
+	} else if (!(pdesc->open_flags & SF_OPEN_WRITE)) {
+		return JESFS_ERR_NOT_OPEN_FOR_WRITE;
+	}
+	if ((pdesc->open_flags & SF_OPEN_RING) || pdesc->_rec_size) {
+		return JESFS_ERR_BAD_FILE_FLAGS;
+	}
+
+	if (jesfs_supply_voltage_check()) {
+		sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+		return JESFS_ERR_VOLTAGE_TOO_LOW; /* Lock Flash Access if power is too low */
+	}
+
+#ifdef JESFS_WRITE_BUFFER
+	struct wbuf_entry *pw = wbuf_find(pdesc);
+
+	if (pw) {
+		len += pw->cnt; /* Not yet in file_pos */
+	}
+#endif
+	/* Room up to the end of the sectors already linked */
+	sadr = pdesc->_wrk_sadr;
+	next = pdesc->_next_sadr;
+	room = SF_SECTOR_PH - pdesc->_sadr_rel;
+	while (room < len) {
+		if (!next) {
+			res = sflash_read(sadr + 8, (uint8_t *)&next, 4);
+			if (res) {
+				return res;
+			}
+		}
+		if (next == 0xFFFFFFFF) {
+			break;
+		}
+		if (sflash_sadr_invalid(next)) {
+			return JESFS_ERR_BAD_SECTOR_ADDR;
+		}
+		sadr = next;
+		next = 0;
+		room += DATA_SECT_B;
+	}
+	if (room >= len) {
+		return 0;
+	}
+	nsect = (len - room + DATA_SECT_B - 1) / DATA_SECT_B;
+	if (nsect > sflash_info.available_disk_size / SF_SECTOR_PH) {
+		return JESFS_ERR_NO_FREE_SECTOR; /* Before anything is written */
+	}
+
+	if (!pdesc->_prealloc) {
+		/* The type first: a link without it would be taken as data */
+		uint8_t ftype = FTYPE_PREALLOC;
+
+		res = sflash_sector_write(pdesc->_head_sadr + FINFO_TYPE_OFS, &ftype, 1);
+		if (res) {
+			return res;
+		}
+		pdesc->_prealloc = 1;
+	}
+	while (nsect--) {
+		next = sflash_get_free_sector(sadr); /* Erased, the one behind if possible */
+		if (!next) {
+			return JESFS_ERR_NO_FREE_SECTOR;
+		}
+		res = sflash_sector_write(sadr + 8, (uint8_t *)&next, 4);
+		if (res) {
+			return res;
+		}
+		sflash_info.databuf.u32[0] = SECTOR_MAGIC_DATA;
+		sflash_info.databuf.u32[1] = pdesc->_head_sadr;
+		res = sflash_sector_write(next, (uint8_t *)&sflash_info.databuf, 8);
+		if (res) {
+			return res;
+		}
+		sflash_info.available_disk_size -= SF_SECTOR_PH;
+		if (sadr == pdesc->_wrk_sadr) {
+			pdesc->_next_sadr = next;
+		}
+		sadr = next;
+	}
+	return 0;
+}
+
+#ifdef JESFS_WRITE_BUFFER
+int16_t jesfs_set_write_buffer(struct jesfs_desc *pdesc, uint8_t *pbuf, uint16_t size)
+{
+	struct wbuf_entry *pw;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	if (!pdesc->_head_sadr) {
+		return JESFS_ERR_BAD_DESCRIPTOR;
+	}
+	if (wbuf_find(pdesc)) {
+		res = jesfs_flush(pdesc);
+		if (res) {
+			return res;
+		}
+		wbuf_release(pdesc);
+	}
+	if (!pbuf || !size) {
+		return 0;
+	}
+	if (!(pdesc->open_flags & (SF_OPEN_WRITE | SF_OPEN_RAW))) {
+		return JESFS_ERR_NOT_OPEN_FOR_WRITE;
+	}
+	pw = wbuf_find(NULL);
+	if (!pw) {
+		return JESFS_ERR_NO_WRITE_BUFFER_SLOT;
+	}
+	pw->pdesc = pdesc;
+	pw->pbuf = pbuf;
+	pw->size = size;
+	pw->cnt = 0;
+	return 0;
+}
+
+int16_t jesfs_flush(struct jesfs_desc *pdesc)
+{
+	struct wbuf_entry *pw;
+	uint16_t cnt;
+	uint8_t i;
+	int16_t res;
+
+	if (sflash_info.state_flags & STATE_DEEPSLEEP_OR_POWERFAIL) {
+		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
+	}
+	for (i = 0; i < JESFS_WRITE_BUFFER; i++) {
+		pw = &wbuf_tab[i];
+		if (!pw->pdesc || !pw->cnt || (pdesc && pw->pdesc != pdesc)) {
+			continue;
+		}
+		if (jesfs_supply_voltage_check()) {
+			sflash_info.state_flags |= STATE_POWERFAIL; /* Lock Flash until DEEPSLEEP */
+			return JESFS_ERR_VOLTAGE_TOO_LOW;
+		}
+		cnt = pw->cnt;
+		pw->cnt = 0;
+		res = flash_write_data(pw->pdesc, pw->pbuf, cnt);
+		if (res) {
+			return res;
+		}
+#ifdef JESFS_TAIL_CACHE
+		tail_cache_put(pw->pdesc);
+#endif
+	}
+	return 0;
+}
+#endif
+
 int16_t jesfs_close(struct jesfs_desc *pdesc)
 {
 	int16_t res;
@@ -1073,8 +4148,22 @@ int16_t jesfs_close(struct jesfs_desc *pdesc)
 		return JESFS_ERR_BAD_DESCRIPTOR;
 	}
 	s0adr = pdesc->_head_sadr;
-	if ((pdesc->open_flags & SF_OPEN_WRITE) ||
-	    ((pdesc->open_flags & SF_OPEN_CREATE) && !(pdesc->open_flags & SF_OPEN_RAW))) {
+#ifdef JESFS_WRITE_BUFFER
+	if (wbuf_find(pdesc)) {
+		res = jesfs_flush(pdesc);
+		wbuf_release(pdesc);
+		if (res) {
+			return res;
+		}
+	}
+#endif
+#ifdef JESFS_SEEK_CACHE
+	seek_release(pdesc);
+#endif
+	/* Ring files stay unclosed: a RAW reopen drops sectors, the start moves */
+	if (((pdesc->open_flags & SF_OPEN_WRITE) ||
+	     ((pdesc->open_flags & SF_OPEN_CREATE) && !(pdesc->open_flags & SF_OPEN_RAW))) &&
+	    !(pdesc->open_flags & SF_OPEN_RING)) {
 		if (sflash_sadr_invalid(s0adr)) {
 			return JESFS_ERR_BAD_SECTOR_ADDR;
 		}
@@ -1091,6 +4180,9 @@ int16_t jesfs_close(struct jesfs_desc *pdesc)
 		if (res) {
 			return res;
 		}
+#ifdef JESFS_TAIL_CACHE
+		tail_cache_drop(s0adr); /* Closed: length known */
+#endif
 	}
 	pdesc->_head_sadr = 0; /* Invalidate descriptor */
 	return 0;	       /* OK */
@@ -1130,6 +4222,12 @@ int16_t jesfs_delete(struct jesfs_desc *pdesc)
 	if (res) {
 		return res;
 	}
+#ifdef JESFS_WRITE_BUFFER
+	wbuf_release(pdesc);
+#endif
+#ifdef JESFS_SEEK_CACHE
+	seek_release(pdesc);
+#endif
 	pdesc->_head_sadr = (uint32_t)0; /* No Close! */
 	return 0;
 }
@@ -1161,9 +4259,25 @@ int16_t jesfs_rename(struct jesfs_desc *pd_odesc, struct jesfs_desc *pd_ndesc)
 	if (!pd_odesc->_head_sadr || !pd_ndesc->_head_sadr) {
 		return JESFS_ERR_RENAME_FILES_NOT_OPEN;
 	}
+#ifdef JESFS_WRITE_BUFFER
+	res = jesfs_flush(pd_odesc);
+	if (!res) {
+		res = jesfs_flush(pd_ndesc);
+	}
+	if (res) {
+		return res;
+	}
+#endif
 	if (pd_ndesc->open_flags & (SF_OPEN_READ | SF_OPEN_RAW)) {
 		return JESFS_ERR_RENAME_OPEN_FOR_READ_OR_RAW;
 	}
+	if (((pd_odesc->open_flags | pd_ndesc->open_flags) & SF_OPEN_RING) ||
+	    pd_odesc->_rec_size || pd_ndesc->_rec_size) {
+		return JESFS_ERR_BAD_FILE_FLAGS; /* The head holds a sector list */
+	}
+	if (pd_odesc->_prealloc) {
+		return JESFS_ERR_BAD_FILE_FLAGS; /* The new head would lose the type */
+	}
 	if (pd_ndesc->file_len) {
 		return JESFS_ERR_RENAME_TARGET_NOT_EMPTY;
 	}
@@ -1209,6 +4323,17 @@ int16_t jesfs_rename(struct jesfs_desc *pd_odesc, struct jesfs_desc *pd_ndesc)
 	if (res) {
 		return res;
 	}
+#ifdef JESFS_NAME_INDEX
+	/* The old head has the new name now */
+	res = sflash_read(pd_odesc->_head_sadr, (uint8_t *)&sflash_info.databuf,
+			  HEADER_SIZE_B + FINFO_SIZE_B);
+	if (res) {
+		return res;
+	}
+	sflash_info.databuf.u8[HEADER_SIZE_B + 12 + FNAMELEN] = 0;
+	name_index_set(pd_odesc->_head_sadr,
+		       name_hash((char *)&sflash_info.databuf.u8[HEADER_SIZE_B + 12]));
+#endif
 
 	pd_ndesc->open_flags = 0;
 	res = jesfs_delete(pd_ndesc);
@@ -1229,7 +4354,7 @@ int16_t jesfs_info(struct jesfs_stat *pstat, uint16_t fno)
 		return JESFS_ERR_FLASH_NOT_ACCESSIBLE;
 	}
 	idx_adr = HEADER_SIZE_B + fno * 4;
-	if (idx_adr > SF_SECTOR_PH - 4) {
+	if (idx_adr >= SF_SECTOR_PH - 4) { /* Last slot: not for files */
 		return FS_STAT_INDEX;
 	}
 	ret = sflash_read(idx_adr, (uint8_t *)&sadr,
@@ -1305,12 +4430,15 @@ int16_t jesfs_check_disk(void cb_printf(const char *fmt, ...))
 	/* Might consume some stack space: */
 	struct jesfs_stat lfs_stat;
 	struct jesfs_desc lfs_desc;
+#ifdef JESFS_WEAR
+	struct jesfs_wear_stat lws;
+#endif
 
 	if (cb_printf) {
 		cb_printf("Check Disk...\n");
 	}
 
-	res = jesfs_start(FS_START_NORMAL);
+	res = jesfs_start(FS_START_NORMAL | FS_START_FULLSCAN);
 	if (res) {
 		if (cb_printf) {
 			cb_printf("ERROR: Disc Error:%d\n", res);
@@ -1328,8 +4456,23 @@ int16_t jesfs_check_disk(void cb_printf(const char *fmt, ...))
 			cb_printf("ERROR: Unknown Sectors: %d\n", sflash_info.sectors_unknown);
 			err++;
 		}
+		cb_printf("SPI: Transactions:%u Reads:%u (%u Bytes) Programs:%u (%u Bytes)\n",
+			  sflash_spi_stat.transactions, sflash_spi_stat.reads,
+			  sflash_spi_stat.bytes_read, sflash_spi_stat.programs,
+			  sflash_spi_stat.bytes_written);
+		cb_printf("SPI: Erases:%u/%u(Block)/%u(Bulk) Status:%u Busy:%u Polls (%u msec)\n",
+			  sflash_spi_stat.erases, sflash_spi_stat.block_erases,
+			  sflash_spi_stat.bulk_erases,
+			  sflash_spi_stat.status_reads, sflash_spi_stat.busy_polls,
+			  sflash_spi_stat.busy_usec / 1000);
 	}
 
+#endif
+#ifdef JESFS_WEAR
+	if (cb_printf && !jesfs_wear_stat(&lws)) {
+		cb_printf("Wear: Erases min/mean/max: %u/%u/%u (Sector %x: max), Unsaved: %u\n",
+			  lws.min, lws.mean, lws.max, lws.max_sadr, lws.unsaved);
+	}
 #endif
 
 	for (i = 0;; i++) {
@@ -1409,25 +4552,15 @@ int16_t jesfs_check_disk(void cb_printf(const char *fmt, ...))
 						}
 						err++;
 					} else {
-						while (aval) {
-							res = jesfs_read(
-								&lfs_desc,
-								(uint8_t *)&sflash_info.databuf,
-								SF_BUFFER_SIZE_B);
-							if (res <= 0 || res > SF_BUFFER_SIZE_B ||
-							    res > aval) {
-								if (cb_printf) {
-									cb_printf("ERROR: Read "
-										  "Data '%s':%d\n",
-										  lfs_stat.fname,
-										  res);
-								}
-								err++;
-								break;
+						lres = jesfs_read_stream(&lfs_desc, aval, NULL,
+									 NULL);
+						if (lres != (int32_t)aval) {
+							if (cb_printf) {
+								cb_printf("ERROR: Read Data '%s':%d\n",
+									  lfs_stat.fname, lres);
 							}
-							aval -= res;
-						}
-						if (lfs_stat.file_crc32 != lfs_desc.file_crc32) {
+							err++;
+						} else if (lfs_stat.file_crc32 != lfs_desc.file_crc32) {
 							if (cb_printf) {
 								cb_printf("ERROR: CRC false '%s'\n",
 									  lfs_stat.fname);
@@ -26,15 +26,55 @@ extern "C" {
  */
 /* #define DEBUG_FORCE_MINIDISK_DENSITY 0x0F */
 
+/* Zephyr's flash API erases synchronously. */
+#if defined(JESFS_ASYNC_ERASE) && defined(__ZEPHYR__)
+#undef JESFS_ASYNC_ERASE
+#endif
+/* The Zephyr flash driver selects its SPI commands (devicetree). */
+#if defined(JESFS_MULTI_IO) && defined(__ZEPHYR__)
+#undef JESFS_MULTI_IO
+#endif
+/* ... and reads the SFDP itself. */
+#if defined(JESFS_SFDP) && defined(__ZEPHYR__)
+#undef JESFS_SFDP
+#endif
+
 #define MIN_DENSITY 0x0D
 #define MAX_DENSITY 0x18
 
+/* Erase blocks of sflash_block_erase(), aligned to their size. */
+#define SF_BLOCK_32K 0x8000
+#define SF_BLOCK_64K 0x10000
+
+/* The wear-aware allocation uses the free sector bitmap. */
+#if defined(JESFS_WEAR) && !defined(JESFS_FREE_BITMAP)
+#error "JESFS_WEAR requires JESFS_FREE_BITMAP"
+#endif
+#define SF_WEAR_SECTORS ((1UL << MAX_DENSITY) / SF_SECTOR_PH)
+
 /* Header at the beginning of every sector. */
 #define HEADER_SIZE_L 3
 #define HEADER_SIZE_B (HEADER_SIZE_L * 4)
 /* Additional file metadata after the HEAD sector header. */
 #define FINFO_SIZE_B 36
 
+/* FINFO byte 35: file type, 0xFF for standard and ring files */
+#define FINFO_TYPE_OFS (HEADER_SIZE_B + 35)
+#define FTYPE_RECORD 0xFE
+#define FTYPE_PREALLOC 0xFD /* Sectors linked ahead: unclosed, the end is searched */
+
+/*
+ * Head of a ring (SF_OPEN_RING) or record file, no data: after FINFO a
+ * parameter (ring: max. number of data sectors, record: record size), then a
+ * list of data sectors (ring: the first one after each drop, record: the
+ * sectors 1..n of the file).
+ */
+#define HEAD_PARAM_OFS (HEADER_SIZE_B + FINFO_SIZE_B)
+#define HEAD_LIST_OFS (HEAD_PARAM_OFS + 4)
+#define HEAD_LIST_L ((SF_SECTOR_PH - HEAD_LIST_OFS) / 4)
+#define DATA_SECT_B (SF_SECTOR_PH - HEADER_SIZE_B) /* Data per sector */
+#define HEAD_DATA_B (DATA_SECT_B - FINFO_SIZE_B)  /* Data in the head of other files */
+
 /*------------------- Internal JesFs constants and functions ------------------------*/
 
 #if !defined(__ZEPHYR__)
@@ -73,6 +113,21 @@ void sflash_select(void);
 void sflash_deselect(void);
 void sflash_spi_read(uint8_t *buf, uint16_t len);
 void sflash_spi_write(const uint8_t *buf, uint16_t len);
+
+/*
+ * Commands the driver transfers on more lines (JESFS_MULTI_IO). The command
+ * byte is always on 1 line, '1-x-y': address (and dummy bytes) on x, data on
+ * y lines.
+ */
+#define SF_IO_FAST_READ 1   /* 0x0B: 1-1-1, 1 dummy byte */
+#define SF_IO_DUAL_OUT 2    /* 0x3B: 1-1-2, 1 dummy byte */
+#define SF_IO_QUAD_OUT 4    /* 0x6B: 1-1-4, 1 dummy byte */
+#define SF_IO_QUAD_IO 8	    /* 0xEB: 1-4-4, mode byte 0xFF and 2 dummy bytes */
+#define SF_IO_QUAD_PP 16    /* 0x32: 1-1-4 page program (GD25) */
+#define SF_IO_QUAD_IO_PP 32 /* 0x38: 1-4-4 page program (MX25R) */
+#ifdef JESFS_MULTI_IO
+uint8_t sflash_spi_io_caps(void);
+#endif
 #else
 #if defined(JESFS_EXPORT_FLASH_DEV)
 extern const struct device *const jesfs_flash_dev;
@@ -109,18 +164,71 @@ void sflash_bulk_erase(void);
 
 #else
 void sflash_ll_sector_erase_4k(uint32_t sadr);
+void sflash_ll_block_erase(uint32_t badr, uint32_t bsize);
+#endif
+
+#ifdef JSTAT
+extern struct jesfs_spi_stat sflash_spi_stat;
 #endif
 
 uint32_t sflash_quick_scan_identification(void);
 int16_t sflash_interpret_id(uint32_t id);
 
 int16_t sflash_read(uint32_t sadr, uint8_t *sbuf, uint16_t len);
+int16_t sflash_blank_check(uint32_t sadr, uint32_t len);
 int16_t sflash_page_write(uint32_t sadr, const uint8_t *sbuf, uint16_t len);
 
 int16_t sflash_wait_busy(uint32_t msec);
+#if !defined(__ZEPHYR__)
+#define SF_BUSY_PROGRAM 0 /* Operation types of sflash_wait_ready() */
+#define SF_BUSY_ERASE 1
+#define SF_BUSY_BLOCK32 2
+#define SF_BUSY_BLOCK64 3
+#define SF_BUSY_BLOCK(bsize) ((bsize) == SF_BLOCK_64K ? SF_BUSY_BLOCK64 : SF_BUSY_BLOCK32)
+void sflash_busy_init(uint32_t id);
+#ifdef JESFS_SFDP
+/* From the Basic Flash Parameter Table (JESD216) of the flash */
+struct sflash_sfdp {
+	uint32_t id;	     /* ID of the last sflash_sfdp_read() */
+	uint8_t valid;	     /* 1: usable for JesFs */
+	uint8_t io_caps;     /* Supported read commands, SF_IO_xxx */
+	uint8_t erase_ops;   /* Erase commands, bit (1 << SF_BUSY_xxx) */
+	uint16_t page_size;
+	uint32_t size;	     /* Bytes */
+	uint32_t t_typ_usec[4]; /* Typical times, index SF_BUSY_xxx, 0: unknown */
+	uint32_t t_max_usec[4];
+	uint8_t erase_suspend; /* Opcodes, 0: no suspend */
+	uint8_t erase_resume;
+};
+extern struct sflash_sfdp sflash_sfdp;
+void sflash_sfdp_read(uint32_t id);
+#endif
+#ifdef JESFS_MULTI_IO
+void sflash_io_init(void);
+#endif
+int16_t sflash_wait_ready(uint8_t op, uint16_t len);
+#endif
 int16_t sflash_wait_write_enabled(void);
 int16_t sflash_sector_write(uint32_t sflash_adr, const uint8_t *sbuf, uint32_t len);
 int16_t sflash_sector_erase(uint32_t sadr);
+int16_t sflash_block_erase(uint32_t badr, uint32_t bsize);
+#ifdef JESFS_CHECKPOINT
+int16_t sflash_ckpt_invalidate(void);
+#endif
+#ifdef JESFS_WEAR
+extern uint16_t sflash_wear_cnt[SF_WEAR_SECTORS];
+extern uint32_t sflash_wear_base;
+extern uint16_t sflash_wear_changes;
+void sflash_wear_count(uint32_t adr, uint32_t len);
+#endif
+#ifdef JESFS_ASYNC_ERASE
+extern uint32_t sflash_erase_sadr;
+int16_t sflash_erase_start(uint32_t sadr, uint32_t size);
+int16_t sflash_erase_poll(void);
+int16_t sflash_erase_wait(void);
+int16_t sflash_erase_suspend(uint32_t sadr, uint16_t len);
+void sflash_erase_init(uint32_t id);
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -21,11 +21,70 @@ struct sflash_info sflash_info = {
 	.state_flags = STATE_DEEPSLEEP,
 };
 
+#ifdef JSTAT
+struct jesfs_spi_stat sflash_spi_stat;
+
+void jesfs_get_spi_stat(struct jesfs_spi_stat *pstat)
+{
+	*pstat = sflash_spi_stat;
+}
+
+void jesfs_reset_spi_stat(void)
+{
+	jesfs_memset((uint8_t *)&sflash_spi_stat, 0, sizeof(sflash_spi_stat));
+}
+#endif
+
+#ifdef JESFS_WEAR
+/*
+ * Erase count per sector: sflash_wear_base + sflash_wear_cnt[]. All erases of
+ * the medium layer count here, the high level persists the table.
+ */
+uint16_t sflash_wear_cnt[SF_WEAR_SECTORS];
+uint32_t sflash_wear_base;
+uint16_t sflash_wear_changes; /* Erases since the table was saved */
+
+/* Count the erase of len bytes (sectors, a block or the whole flash) at adr. */
+void sflash_wear_count(uint32_t adr, uint32_t len)
+{
+	uint32_t nsect = sflash_info.total_flash_size / SF_SECTOR_PH;
+	uint32_t sect = adr / SF_SECTOR_PH;
+	uint32_t i;
+	uint16_t min;
+
+	for (len /= SF_SECTOR_PH; len--; sect++) {
+		if (sflash_wear_cnt[sect] == 0xFFFF) {
+			/* Renormalize (sector 0 is only erased by formats: not regarded) */
+			min = 0xFFFF;
+			for (i = 1; i < nsect; i++) {
+				if (sflash_wear_cnt[i] < min) {
+					min = sflash_wear_cnt[i];
+				}
+			}
+			for (i = 0; i < nsect; i++) {
+				sflash_wear_cnt[i] = (sflash_wear_cnt[i] > min) ? sflash_wear_cnt[i] - min : 0;
+			}
+			sflash_wear_base += min;
+			if (sflash_wear_cnt[sect] == 0xFFFF) {
+				continue; /* Spread > 64k: saturated */
+			}
+		}
+		sflash_wear_cnt[sect]++;
+	}
+	if (sflash_wear_changes != 0xFFFF) {
+		sflash_wear_changes++;
+	}
+}
+#endif
+
 /* ------------------- Medium-level SPI start ------------------------ */
 #if !defined(__ZEPHYR__)
 /* Send a single-byte SPI command. More bytes may follow before deselecting. */
 void sflash_bytecmd(uint8_t cmd, uint8_t more)
 {
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+#endif
 	sflash_select();
 	sflash_spi_write(&cmd, 1);
 	if (!more) {
@@ -57,6 +116,153 @@ uint32_t sflash_quick_scan_identification(void)
 #endif
 }
 
+#ifdef JESFS_SFDP
+/*
+ * SFDP (JESD216): the flash describes itself in its Basic Flash Parameter
+ * Table (BFPT). JesFs needs a uniform 4k erase with 0x20 and 3-byte
+ * addresses. Only read modes with the dummy clocks of JesFs are taken.
+ */
+#define CMD_READ_SFDP 0x5A
+#define SFDP_SIGNATURE 0x50444653 /* "SFDP" */
+#define SFDP_BFPT_DWORDS 16	  /* JESD216B, older tables have 9 */
+struct sflash_sfdp sflash_sfdp;
+
+/* Read n DWORDs (little endian) of the SFDP at adr. */
+static void sflash_sfdp_get(uint32_t adr, uint32_t *pdw, uint8_t n)
+{
+	uint8_t buf[5];
+	uint8_t *pb;
+	uint8_t i;
+
+	buf[0] = CMD_READ_SFDP;
+	buf[1] = (uint8_t)(adr >> 16);
+	buf[2] = (uint8_t)(adr >> 8);
+	buf[3] = (uint8_t)(adr);
+	buf[4] = 0xFF; /* 8 dummy clocks */
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+#endif
+	sflash_select();
+	sflash_spi_write(buf, 5);
+	sflash_spi_read((uint8_t *)pdw, n * 4);
+	sflash_deselect();
+	for (i = 0; i < n; i++) {
+		pb = (uint8_t *)&pdw[i];
+		pdw[i] = pb[0] | ((uint32_t)pb[1] << 8) | ((uint32_t)pb[2] << 16) | ((uint32_t)pb[3] << 24);
+	}
+}
+
+/* Fill sflash_sfdp (once per ID), .valid is 0 without a usable BFPT. */
+void sflash_sfdp_read(uint32_t id)
+{
+	static const uint32_t erase_unit_usec[4] = { 1000, 16000, 128000, 1000000 };
+	uint32_t bfpt[SFDP_BFPT_DWORDS];
+	uint32_t dw;
+	uint32_t mult;
+	uint8_t n;
+	uint8_t i;
+	uint8_t op;
+
+	if (id == sflash_sfdp.id) {
+		return;
+	}
+	jesfs_memset((uint8_t *)&sflash_sfdp, 0, sizeof(sflash_sfdp));
+	sflash_sfdp.id = id;
+	/* Header and first parameter header: the BFPT (ID 0xFF00) */
+	sflash_sfdp_get(0, bfpt, 4);
+	if (bfpt[0] != SFDP_SIGNATURE || (bfpt[2] & 0xFF) || (bfpt[3] >> 24) != 0xFF) {
+		return;
+	}
+	n = (uint8_t)(bfpt[2] >> 24); /* Length in DWORDs */
+	if (n < 9) {
+		return;
+	}
+	if (n > SFDP_BFPT_DWORDS) {
+		n = SFDP_BFPT_DWORDS;
+	}
+	sflash_sfdp_get(bfpt[3] & 0xFFFFFF, bfpt, n);
+
+	/* DWORD 1: 4k erase command, address bytes, fast reads */
+	dw = bfpt[0];
+	if ((dw & 3) != 1 || ((dw >> 8) & 0xFF) != 0x20 || ((dw >> 17) & 3) == 2) {
+		return;
+	}
+	sflash_sfdp.io_caps = SF_IO_FAST_READ;
+	if ((dw & (1UL << 16)) && (bfpt[3] & 0xFFFF) == 0x3B08) {
+		sflash_sfdp.io_caps |= SF_IO_DUAL_OUT;
+	}
+	if ((dw & (1UL << 22)) && (bfpt[2] >> 16) == 0x6B08) {
+		sflash_sfdp.io_caps |= SF_IO_QUAD_OUT;
+	}
+	i = (uint8_t)bfpt[2]; /* 1-4-4: mode clocks.3 dummy clocks.5 */
+	if ((dw & (1UL << 21)) && ((bfpt[2] >> 8) & 0xFF) == 0xEB && (i & 31) + (i >> 5) == 6) {
+		sflash_sfdp.io_caps |= SF_IO_QUAD_IO;
+	}
+
+	/* DWORD 2: density in bits */
+	dw = bfpt[1];
+	if (dw & 0x80000000UL) {
+		dw &= 0x7FFFFFFFUL; /* 2^N bits */
+		if (dw < MIN_DENSITY + 3 || dw > MAX_DENSITY + 3) {
+			return;
+		}
+		sflash_sfdp.size = 1UL << (dw - 3);
+	} else {
+		sflash_sfdp.size = (dw >> 3) + 1; /* N+1 bits */
+		if ((sflash_sfdp.size & (sflash_sfdp.size - 1)) || sflash_sfdp.size < (1UL << MIN_DENSITY) ||
+		    sflash_sfdp.size > (1UL << MAX_DENSITY)) {
+			return;
+		}
+	}
+
+	/* DWORDs 8-9: erase types (size 2^N.8 command.8), DWORD 10: their times */
+	mult = (n >= 10) ? 2 * ((bfpt[9] & 15) + 1) : 0;
+	for (i = 0; i < 4; i++) {
+		dw = (bfpt[7 + (i >> 1)] >> ((i & 1) * 16)) & 0xFFFF;
+		if (dw == 0x200C) {
+			op = SF_BUSY_ERASE;
+		} else if (dw == 0x520F) {
+			op = SF_BUSY_BLOCK32;
+		} else if (dw == 0xD810) {
+			op = SF_BUSY_BLOCK64;
+		} else {
+			continue;
+		}
+		sflash_sfdp.erase_ops |= 1 << op;
+		if (n >= 10) {
+			dw = bfpt[9] >> (4 + 7 * i); /* Count.5 units.2 */
+			sflash_sfdp.t_typ_usec[op] = ((dw & 31) + 1) * erase_unit_usec[(dw >> 5) & 3];
+			sflash_sfdp.t_max_usec[op] = sflash_sfdp.t_typ_usec[op] * mult;
+		}
+	}
+
+	/* DWORD 11: page size and page program time */
+	sflash_sfdp.page_size = 256;
+	if (n >= 11) {
+		dw = bfpt[10];
+		sflash_sfdp.page_size = 1 << ((dw >> 4) & 15);
+		if (sflash_sfdp.page_size < 256) {
+			return;
+		}
+		sflash_sfdp.t_typ_usec[SF_BUSY_PROGRAM] = (((dw >> 8) & 31) + 1) * ((dw & (1UL << 13)) ? 64 : 8);
+		sflash_sfdp.t_max_usec[SF_BUSY_PROGRAM] = sflash_sfdp.t_typ_usec[SF_BUSY_PROGRAM] * 2 * ((dw & 15) + 1);
+	}
+
+	/* DWORD 12: bit 31 clear if suspend/resume exist, DWORD 13: their opcodes */
+	if (n >= 13 && !(bfpt[11] & 0x80000000UL)) {
+		sflash_sfdp.erase_suspend = (uint8_t)(bfpt[12] >> 24);
+		sflash_sfdp.erase_resume = (uint8_t)(bfpt[12] >> 16);
+	}
+	sflash_sfdp.valid = 1;
+}
+
+/* 1: the flash has no such block erase (SFDP), erase it sector by sector. */
+static uint8_t sflash_sfdp_no_block_erase(uint32_t bsize)
+{
+	return sflash_sfdp.valid && !(sflash_sfdp.erase_ops & (1 << SF_BUSY_BLOCK(bsize)));
+}
+#endif
+
 /* Interpret the 3-byte JEDEC ID and derive the usable flash size. */
 int16_t sflash_interpret_id(uint32_t id)
 {
@@ -73,8 +279,16 @@ int16_t sflash_interpret_id(uint32_t id)
 		return JESFS_ERR_FLASH_ID_UNCONNECTED; /* Unconnected in SPI? */
 	}
 
+#ifdef JESFS_SFDP
+	sflash_sfdp_read(id);
+#endif
 	switch (id >> 8) { /* Check manufacturer and type, without density. */
 	default:
+#ifdef JESFS_SFDP
+		if (sflash_sfdp.valid) {
+			break; /* Unknown ID, but described by its SFDP */
+		}
+#endif
 		return JESFS_ERR_FLASH_ID_UNKNOWN;
 
 /* Tested/known-good flash manufacturer/type IDs. More IDs may be added later. */
@@ -89,11 +303,28 @@ int16_t sflash_interpret_id(uint32_t id)
 	h = DEBUG_FORCE_MINIDISK_DENSITY; /* Mini disk, at least two sectors. */
 #else
 	h = id & 255; /* Density */
+#ifdef JESFS_SFDP
+	if (sflash_sfdp.valid) {
+		h = MIN_DENSITY;
+		while ((1UL << h) < sflash_sfdp.size) {
+			h++;
+		}
+	}
+#endif
 	if (h < MIN_DENSITY || h > MAX_DENSITY) {
 		return JESFS_ERR_FLASH_ID_BAD_DENSITY; /* Unknown density. */
 	}
 #endif
 	sflash_info.total_flash_size = 1 << h;
+#if !defined(__ZEPHYR__)
+	sflash_busy_init(id);
+#ifdef JESFS_MULTI_IO
+	sflash_io_init();
+#endif
+#ifdef JESFS_ASYNC_ERASE
+	sflash_erase_init(id);
+#endif
+#endif
 	return 0;
 }
 
@@ -102,6 +333,9 @@ int16_t sflash_interpret_id(uint32_t id)
 #define CMD_DEEPPOWERDOWN 0xB9
 void sflash_deep_power_down(void)
 {
+#ifdef JESFS_ASYNC_ERASE
+	(void)sflash_erase_wait(); /* A sleeping flash would abort the erase */
+#endif
 	sflash_bytecmd(CMD_DEEPPOWERDOWN, 0); /* NoMore */
 }
 
@@ -115,26 +349,128 @@ void sflash_deep_power_down(void)
 #define CMD_RELEASEDPD 0xAB
 void sflash_release_from_deep_power_down(void)
 {
+#ifdef JESFS_ASYNC_ERASE
+	(void)sflash_erase_wait(); /* jesfs_start() without jesfs_deepsleep() */
+#endif
 	sflash_bytecmd(CMD_RELEASEDPD, 0); /* NoMore */
 	/* Delay is handled by the caller. */
 }
 #endif /* __ZEPHYR__ */
 
+#if !defined(__ZEPHYR__)
+/* Read and page program commands */
+#define CMD_READDATA 0x03
+#define CMD_PAGEWRITE 0x02
+#ifdef JESFS_MULTI_IO
+#define CMD_FASTREAD 0x0B
+#define CMD_DUALREAD 0x3B
+#define CMD_QUADREAD 0x6B
+#define CMD_QUADIOREAD 0xEB
+#define CMD_QUADPAGEWRITE 0x32
+#define CMD_QUADIOPAGEWRITE 0x38
+
+static uint8_t sflash_rd_cmd = CMD_READDATA;
+static uint8_t sflash_rd_dummy; /* Bytes after the address */
+static uint8_t sflash_pp_cmd = CMD_PAGEWRITE;
+
 /*
- * Read len bytes from flash address sadr into sbuf.
- * For addresses >=16MB the bare-metal driver needs the 4-byte command (0x13).
+ * Multi-line commands of the flash: the known types by ID, the quad page
+ * programs differ (0x38 only MX25R, 0x32 only GD25WQ). Other flashes: the
+ * reads of their SFDP, the BFPT has no page program modes.
  */
-#define CMD_READDATA 0x03
-int16_t sflash_read(uint32_t sadr, uint8_t *sbuf, uint16_t len)
+static uint8_t sflash_flash_io_caps(uint32_t id)
 {
-#if !defined(__ZEPHYR__)
-	uint8_t buf[4]; /* */
-	buf[0] = CMD_READDATA;
+	switch (id >> 8) {
+	case MACRONIX_MANU_TYP_RX:
+		return SF_IO_FAST_READ | SF_IO_DUAL_OUT | SF_IO_QUAD_OUT | SF_IO_QUAD_IO |
+		       SF_IO_QUAD_IO_PP;
+	case GIGADEV_MANU_TYP_WD:
+		return SF_IO_FAST_READ | SF_IO_DUAL_OUT;
+	case GIGADEV_MANU_TYP_WQ:
+		return SF_IO_FAST_READ | SF_IO_DUAL_OUT | SF_IO_QUAD_OUT | SF_IO_QUAD_IO |
+		       SF_IO_QUAD_PP;
+	default:
+#ifdef JESFS_SFDP
+		return sflash_sfdp.io_caps;
+#else
+		return 0;
+#endif
+	}
+}
+
+/* Use the fastest commands of the flash the driver supports (sflash_spi_io_caps()). */
+void sflash_io_init(void)
+{
+	uint8_t caps = sflash_spi_io_caps() & sflash_flash_io_caps(sflash_info.identification);
+
+	sflash_rd_dummy = 1;
+	if (caps & SF_IO_QUAD_IO) {
+		sflash_rd_cmd = CMD_QUADIOREAD;
+		sflash_rd_dummy = 3;
+	} else if (caps & SF_IO_QUAD_OUT) {
+		sflash_rd_cmd = CMD_QUADREAD;
+	} else if (caps & SF_IO_DUAL_OUT) {
+		sflash_rd_cmd = CMD_DUALREAD;
+	} else if (caps & SF_IO_FAST_READ) {
+		sflash_rd_cmd = CMD_FASTREAD;
+	} else {
+		sflash_rd_cmd = CMD_READDATA;
+		sflash_rd_dummy = 0;
+	}
+	if (caps & SF_IO_QUAD_IO_PP) {
+		sflash_pp_cmd = CMD_QUADIOPAGEWRITE;
+	} else if (caps & SF_IO_QUAD_PP) {
+		sflash_pp_cmd = CMD_QUADPAGEWRITE;
+	} else {
+		sflash_pp_cmd = CMD_PAGEWRITE;
+	}
+}
+#else
+#define sflash_rd_cmd CMD_READDATA
+#define sflash_rd_dummy 0
+#define sflash_pp_cmd CMD_PAGEWRITE
+#endif
+
+/* Select the flash and send the read command for sadr, the data follows. */
+static void sflash_read_cmd(uint32_t sadr)
+{
+	uint8_t buf[7];
+
+	buf[0] = sflash_rd_cmd;
 	buf[1] = (uint8_t)(sadr >> 16);
 	buf[2] = (uint8_t)(sadr >> 8);
 	buf[3] = (uint8_t)(sadr);
+	buf[4] = 0xFF; /* 0xEB: mode byte, no continuous read */
+	buf[5] = 0xFF;
+	buf[6] = 0xFF;
 	sflash_select();
-	sflash_spi_write(buf, 4);
+	sflash_spi_write(buf, 4 + sflash_rd_dummy);
+}
+#endif /* __ZEPHYR__ */
+
+/*
+ * Read len bytes from flash address sadr into sbuf (JESFS_MULTI_IO: with the
+ * command of sflash_io_init()).
+ * For addresses >=16MB the bare-metal driver needs the 4-byte command (0x13).
+ */
+int16_t sflash_read(uint32_t sadr, uint8_t *sbuf, uint16_t len)
+{
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+	sflash_spi_stat.reads++;
+	sflash_spi_stat.bytes_read += len;
+#endif
+#if !defined(__ZEPHYR__)
+#ifdef JESFS_ASYNC_ERASE
+	if (sflash_erase_sadr) {
+		int16_t res = sflash_erase_suspend(sadr, len);
+
+		if (res) {
+			return res;
+		}
+	}
+#endif
+	sflash_read_cmd(sadr);
 	sflash_spi_read(sbuf, len);
 	sflash_deselect();
 	return 0; /* Direct SPI access reports no error here. */
@@ -143,12 +479,77 @@ int16_t sflash_read(uint32_t sadr, uint8_t *sbuf, uint16_t len)
 #endif
 }
 
+/*
+ * Check that len bytes at sadr are erased (0xFF). Returns 0: blank, 1: not
+ * blank, or an error. Bare metal reads the range with a single read command
+ * (in SF_BUFFER_SIZE_B pieces) and compares word-wise.
+ */
+int16_t sflash_blank_check(uint32_t sadr, uint32_t len)
+{
+	uint32_t *pw;
+	uint32_t acc;
+	uint16_t wlen;
+	uint16_t i;
+	int16_t res = 0;
+
+#if !defined(__ZEPHYR__)
+#ifdef JESFS_ASYNC_ERASE
+	if (sflash_erase_sadr) {
+		res = sflash_erase_suspend(sadr, len);
+		if (res) {
+			return res;
+		}
+	}
+#endif
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+	sflash_spi_stat.reads++;
+#endif
+	sflash_read_cmd(sadr);
+#endif
+	while (len && !res) {
+		wlen = SF_BUFFER_SIZE_B;
+		if (wlen > len) {
+			wlen = (uint16_t)len;
+		}
+#if !defined(__ZEPHYR__)
+#ifdef JSTAT
+		sflash_spi_stat.bytes_read += wlen;
+#endif
+		sflash_spi_read(sflash_info.databuf.u8, wlen);
+#else
+		res = sflash_read(sadr, sflash_info.databuf.u8, wlen);
+		if (res) {
+			return res;
+		}
+		sadr += wlen;
+#endif
+		len -= wlen;
+		pw = sflash_info.databuf.u32;
+		acc = 0xFFFFFFFF;
+		for (i = wlen / 4; i; i--) {
+			acc &= *pw++;
+		}
+		for (i = wlen & ~3; i < wlen; i++) {
+			acc &= 0xFFFFFF00 | sflash_info.databuf.u8[i];
+		}
+		res = (acc != 0xFFFFFFFF);
+	}
+#if !defined(__ZEPHYR__)
+	sflash_deselect(); /* Stops the read, also early */
+#endif
+	return res;
+}
+
 #if !defined(__ZEPHYR__)
 /* Read status register. Bit 0: write in progress, bit 1: write enabled. */
 #define CMD_STATUSREG 0x05
 uint8_t sflash_read_status_reg(void)
 {
 	uint8_t buf;
+#ifdef JSTAT
+	sflash_spi_stat.status_reads++;
+#endif
 	sflash_bytecmd(CMD_STATUSREG, 1); /* More */
 	sflash_spi_read(&buf, 1);
 	sflash_deselect();
@@ -170,12 +571,16 @@ void sflash_write_enable(void)
  * * The write-enable latch must be set before this call and is cleared by the
  * flash after the page program operation.
  */
-#define CMD_PAGEWRITE 0x02
 int16_t sflash_page_write(uint32_t sadr, const uint8_t *sbuf, uint16_t len)
 {
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+	sflash_spi_stat.programs++;
+	sflash_spi_stat.bytes_written += len;
+#endif
 #if !defined(__ZEPHYR__)
 	uint8_t buf[4]; /* */
-	buf[0] = CMD_PAGEWRITE;
+	buf[0] = sflash_pp_cmd;
 	buf[1] = (uint8_t)(sadr >> 16);
 	buf[2] = (uint8_t)(sadr >> 8);
 	buf[3] = (uint8_t)(sadr);
@@ -194,6 +599,12 @@ int16_t sflash_page_write(uint32_t sadr, const uint8_t *sbuf, uint16_t len)
 #define CMD_BULKERASE 0xC7
 void sflash_bulk_erase(void)
 {
+#ifdef JSTAT
+	sflash_spi_stat.bulk_erases++;
+#endif
+#ifdef JESFS_WEAR
+	sflash_wear_count(0, sflash_info.total_flash_size);
+#endif
 	sflash_bytecmd(CMD_BULKERASE, 0); /* NoMore */
 }
 #endif
@@ -215,6 +626,31 @@ void sflash_ll_sector_erase_4k(uint32_t sadr)
 	buf[1] = (uint8_t)(sadr >> 16);
 	buf[2] = (uint8_t)(sadr >> 8);
 	buf[3] = (uint8_t)(sadr);
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+#endif
+	sflash_select();
+	sflash_spi_write(buf, 4);
+	sflash_deselect();
+}
+
+/*
+ * Block erase, 32k or 64k (aligned). Takes about the time of 4-12 sector
+ * erases, up to some seconds max.
+ */
+#define CMD_BLOCK32K_ERASE 0x52
+#define CMD_BLOCK64K_ERASE 0xD8
+#define SF_BLOCK_ERASE_MAX_MSEC 4000
+void sflash_ll_block_erase(uint32_t badr, uint32_t bsize)
+{
+	uint8_t buf[4]; /* */
+	buf[0] = (bsize == SF_BLOCK_64K) ? CMD_BLOCK64K_ERASE : CMD_BLOCK32K_ERASE;
+	buf[1] = (uint8_t)(badr >> 16);
+	buf[2] = (uint8_t)(badr >> 8);
+	buf[3] = (uint8_t)(badr);
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+#endif
 	sflash_select();
 	sflash_spi_write(buf, 4);
 	sflash_deselect();
@@ -227,18 +663,135 @@ int16_t sflash_wait_busy(uint32_t msec)
 {
 	while (msec--) {
 		sflash_wait_usec(1000);
+#ifdef JSTAT
+		sflash_spi_stat.busy_polls++;
+		sflash_spi_stat.busy_usec += 1000;
+#endif
 		if (!(sflash_read_status_reg() & 1)) {
 			return 0; /* OK */
 		}
 	}
 	return JESFS_ERR_FLASH_TIMEOUT;
 }
+
+/*
+ * Adaptive busy polling for program and erase: the first status read follows
+ * after 3/4 of the expected time, then the poll interval doubles from 1/16 of
+ * it (at least SF_POLL_MIN_USEC, at most 1 msec). The expected time starts
+ * with the datasheet 'typical' of the flash type (JESFS_SFDP: of its SFDP,
+ * also the timeout) and follows the measured times (running average, weight
+ * 1/4).
+ */
+#define SF_POLL_MIN_USEC 8
+#define SF_POLL_MAX_USEC 1000
+static const struct sflash_busy_typ {
+	uint16_t manu_typ;  /* 0xMMTT */
+	uint16_t t_pp_usec; /* Page program, 256 bytes */
+	uint32_t t_se_usec; /* Sector erase, 4k */
+	uint32_t t_be32_usec; /* Block erase 32k */
+	uint32_t t_be64_usec; /* Block erase 64k */
+} sflash_busy_typs[] = {
+	{ MACRONIX_MANU_TYP_RX, 850, 40000, 240000, 480000 },
+	{ GIGADEV_MANU_TYP_WD, 600, 50000, 150000, 250000 },
+	{ GIGADEV_MANU_TYP_WQ, 500, 45000, 150000, 250000 },
+};
+static uint32_t sflash_busy_id;
+static uint32_t sflash_busy_usec[4]; /* Expected time, index SF_BUSY_xxx */
+static uint32_t sflash_busy_max_usec[4]; /* Timeout */
+
+/* Typical times for a new flash, learned times are kept for the same ID. */
+void sflash_busy_init(uint32_t id)
+{
+	uint8_t i;
+
+	if (id == sflash_busy_id) {
+		return;
+	}
+	sflash_busy_id = id;
+	for (i = sizeof(sflash_busy_typs) / sizeof(sflash_busy_typs[0]) - 1; i; i--) {
+		if (sflash_busy_typs[i].manu_typ == (id >> 8)) {
+			break;
+		}
+	}
+	sflash_busy_usec[SF_BUSY_PROGRAM] = sflash_busy_typs[i].t_pp_usec;
+	sflash_busy_usec[SF_BUSY_ERASE] = sflash_busy_typs[i].t_se_usec;
+	sflash_busy_usec[SF_BUSY_BLOCK32] = sflash_busy_typs[i].t_be32_usec;
+	sflash_busy_usec[SF_BUSY_BLOCK64] = sflash_busy_typs[i].t_be64_usec;
+	sflash_busy_max_usec[SF_BUSY_PROGRAM] = 100000; /* 100 msec max page */
+	sflash_busy_max_usec[SF_BUSY_ERASE] = 400000;
+	sflash_busy_max_usec[SF_BUSY_BLOCK32] = SF_BLOCK_ERASE_MAX_MSEC * 1000UL;
+	sflash_busy_max_usec[SF_BUSY_BLOCK64] = SF_BLOCK_ERASE_MAX_MSEC * 1000UL;
+#ifdef JESFS_SFDP
+	if (sflash_sfdp.valid) {
+		for (i = 0; i < 4; i++) {
+			if (sflash_sfdp.t_typ_usec[i]) {
+				sflash_busy_usec[i] = sflash_sfdp.t_typ_usec[i];
+				sflash_busy_max_usec[i] = sflash_sfdp.t_max_usec[i];
+			}
+		}
+	}
+#endif
+}
+
+/* Wait for the end of a page program of len bytes or of an erase. */
+int16_t sflash_wait_ready(uint8_t op, uint16_t len)
+{
+	uint32_t expect = sflash_busy_usec[op];
+	uint32_t max_usec = sflash_busy_max_usec[op];
+	uint32_t wait;
+	uint32_t step;
+	uint32_t waited;
+
+	if (op == SF_BUSY_PROGRAM) {
+		expect = expect * len / 256;
+	}
+	wait = expect - (expect >> 2);
+	step = expect >> 4;
+	if (step < SF_POLL_MIN_USEC) {
+		step = SF_POLL_MIN_USEC;
+	} else if (step > SF_POLL_MAX_USEC) {
+		step = SF_POLL_MAX_USEC;
+	}
+	waited = wait;
+	for (;;) {
+		sflash_wait_usec(wait);
+#ifdef JSTAT
+		sflash_spi_stat.busy_polls++;
+		sflash_spi_stat.busy_usec += wait;
+#endif
+		if (!(sflash_read_status_reg() & 1)) {
+			break;
+		}
+		if (waited >= max_usec) {
+			return JESFS_ERR_FLASH_TIMEOUT;
+		}
+		wait = step;
+		waited += wait;
+		step <<= 1;
+		if (step > SF_POLL_MAX_USEC) {
+			step = SF_POLL_MAX_USEC;
+		}
+	}
+	/* Learn from full pages: the end was in the last interval */
+	if (op != SF_BUSY_PROGRAM || len == 256) {
+		waited -= wait >> 1;
+		sflash_busy_usec[op] += ((int32_t)waited - (int32_t)sflash_busy_usec[op]) / 4;
+	}
+	return 0;
+}
 #endif
 
 #if !defined(__ZEPHYR__)
 /* Set write-enable and verify that the latch is set. */
 int16_t sflash_wait_write_enabled(void)
 {
+#ifdef JESFS_ASYNC_ERASE
+	int16_t res = sflash_erase_wait(); /* Every modification starts here */
+
+	if (res) {
+		return res;
+	}
+#endif
 	sflash_write_enable();
 	if (sflash_read_status_reg() & 2) {
 		return 0;
@@ -247,6 +800,171 @@ int16_t sflash_wait_write_enabled(void)
 }
 #endif /* __ZEPHYR__ */
 
+#ifdef JESFS_ASYNC_ERASE
+/*
+ * Background erase: sflash_erase_start() returns after the erase command,
+ * reads suspend the erase (erase-suspend 0x75 of MX25R and GD25) and leave it
+ * suspended, so a burst of reads costs one suspend. sflash_erase_poll()
+ * (e.g. jesfs_gc() in idle time) resumes (0x7A) it, every modification and
+ * deep power down wait for the end of the erase. Other flashes use the
+ * opcodes of their SFDP, without them reads wait for the end of the erase.
+ */
+#define CMD_ERASE_SUSPEND 0x75
+#define CMD_ERASE_RESUME 0x7A
+#define SF_SUSPEND_POLL_USEC 10	  /* tESL: 20-30 usec */
+#define SF_SUSPEND_POLL_MAX 100
+uint32_t sflash_erase_sadr; /* Sector/block of the background erase, 0: none */
+static uint32_t sflash_erase_size;
+static uint8_t sflash_erase_suspended;
+static uint8_t sflash_suspend_cmd = CMD_ERASE_SUSPEND; /* 0: no suspend */
+static uint8_t sflash_resume_cmd = CMD_ERASE_RESUME;
+
+/* Suspend/resume opcodes of the flash (by ID, else its SFDP). */
+void sflash_erase_init(uint32_t id)
+{
+	switch (id >> 8) {
+	case MACRONIX_MANU_TYP_RX:
+	case GIGADEV_MANU_TYP_WD:
+	case GIGADEV_MANU_TYP_WQ:
+		sflash_suspend_cmd = CMD_ERASE_SUSPEND;
+		sflash_resume_cmd = CMD_ERASE_RESUME;
+		break;
+	default:
+#ifdef JESFS_SFDP
+		sflash_suspend_cmd = sflash_sfdp.erase_suspend;
+		sflash_resume_cmd = sflash_sfdp.erase_resume;
+#else
+		sflash_suspend_cmd = 0;
+#endif
+	}
+}
+
+static void sflash_erase_resume(void)
+{
+	if (sflash_erase_suspended) {
+		sflash_erase_suspended = 0;
+		sflash_bytecmd(sflash_resume_cmd, 0); /* NoMore */
+	}
+}
+
+/* Start the erase of a sector (size SF_SECTOR_PH) or block. */
+int16_t sflash_erase_start(uint32_t sadr, uint32_t size)
+{
+	int16_t res;
+
+#ifdef JESFS_SFDP
+	if (size != SF_SECTOR_PH && sflash_sfdp_no_block_erase(size)) {
+		return sflash_block_erase(sadr, size); /* Synchronous */
+	}
+#endif
+#ifdef JESFS_CHECKPOINT
+	if (sflash_info.ckpt_live_adr) {
+		res = sflash_ckpt_invalidate();
+		if (res) {
+			return res;
+		}
+	}
+#endif
+	res = sflash_wait_write_enabled(); /* Also waits for the previous erase */
+	if (res) {
+		return res;
+	}
+	if (size == SF_SECTOR_PH) {
+#ifdef JSTAT
+		sflash_spi_stat.erases++;
+#endif
+		sflash_ll_sector_erase_4k(sadr);
+	} else {
+#ifdef JSTAT
+		sflash_spi_stat.block_erases++;
+#endif
+		sflash_ll_block_erase(sadr, size);
+	}
+#ifdef JESFS_WEAR
+	sflash_wear_count(sadr, size);
+#endif
+	sflash_erase_sadr = sadr;
+	sflash_erase_size = size;
+	return 0;
+}
+
+/* Returns 1 while the background erase is running (resumes it), else 0. */
+int16_t sflash_erase_poll(void)
+{
+	if (!sflash_erase_sadr) {
+		return 0;
+	}
+	sflash_erase_resume();
+	if (sflash_read_status_reg() & 1) {
+		return 1;
+	}
+	sflash_erase_sadr = 0;
+	return 0;
+}
+
+/* Wait for the end of the background erase (if any). */
+int16_t sflash_erase_wait(void)
+{
+	if (!sflash_erase_sadr) {
+		return 0;
+	}
+	sflash_erase_resume();
+	sflash_erase_sadr = 0;
+	if (sflash_wait_busy(sflash_erase_size == SF_SECTOR_PH ? 400 : SF_BLOCK_ERASE_MAX_MSEC)) {
+		return JESFS_ERR_FLASH_TIMEOUT;
+	}
+	return 0;
+}
+
+/*
+ * Make the flash readable for len bytes at sadr: suspend the background erase,
+ * or wait for its end if the read touches the sector under erase.
+ */
+int16_t sflash_erase_suspend(uint32_t sadr, uint16_t len)
+{
+	uint8_t n;
+
+	if ((sadr < sflash_erase_sadr + sflash_erase_size && sadr + len > sflash_erase_sadr) ||
+	    !sflash_suspend_cmd) {
+		return sflash_erase_wait(); /* Content undefined until erased (or no suspend) */
+	}
+	if (sflash_erase_suspended) {
+		return 0;
+	}
+	if (!(sflash_read_status_reg() & 1)) {
+		sflash_erase_sadr = 0; /* Done meanwhile */
+		return 0;
+	}
+	sflash_bytecmd(sflash_suspend_cmd, 0); /* NoMore */
+	sflash_erase_suspended = 1;
+#ifdef JSTAT
+	sflash_spi_stat.erase_suspends++;
+#endif
+	for (n = 0; n < SF_SUSPEND_POLL_MAX; n++) {
+		sflash_wait_usec(SF_SUSPEND_POLL_USEC);
+		if (!(sflash_read_status_reg() & 1)) {
+			return 0;
+		}
+	}
+	return JESFS_ERR_FLASH_TIMEOUT;
+}
+#endif
+
+#ifdef JESFS_CHECKPOINT
+/*
+ * The first flash modification after jesfs_checkpoint() clears the valid
+ * word of the checkpoint record (see jesfs_hl.c).
+ */
+int16_t sflash_ckpt_invalidate(void)
+{
+	static const uint32_t outdated = 0;
+	uint32_t radr = sflash_info.ckpt_live_adr;
+
+	sflash_info.ckpt_live_adr = 0;
+	return sflash_sector_write(radr + 4, (const uint8_t *)&outdated, 4);
+}
+#endif
+
 /*
  * Write up to one sector, split into page-program operations where required.
  *
@@ -264,6 +982,14 @@ int16_t sflash_sector_write(uint32_t sflash_adr, const uint8_t *sbuf, uint32_t l
 	    len > (sflash_info.total_flash_size - sflash_adr)) {
 		return JESFS_ERR_FLASH_ADDR_INVALID; /* Address range exceeds the flash. */
 	}
+#ifdef JESFS_CHECKPOINT
+	if (sflash_info.ckpt_live_adr) {
+		res = sflash_ckpt_invalidate();
+		if (res) {
+			return res;
+		}
+	}
+#endif
 
 #if !defined(__ZEPHYR__)
 	uint32_t maxwrite = SF_SECTOR_PH - (sflash_adr & (SF_SECTOR_PH - 1));
@@ -288,8 +1014,9 @@ int16_t sflash_sector_write(uint32_t sflash_adr, const uint8_t *sbuf, uint32_t l
 		if (res) {
 			return res;
 		}
-		if (sflash_wait_busy(100)) {
-			return JESFS_ERR_FLASH_TIMEOUT; /* 100 ms until page program should be done. */
+		res = sflash_wait_ready(SF_BUSY_PROGRAM, maxwrite);
+		if (res) {
+			return res;
 		}
 		sbuf += maxwrite;
 		sflash_adr += maxwrite;
@@ -308,17 +1035,82 @@ int16_t sflash_sector_write(uint32_t sflash_adr, const uint8_t *sbuf, uint32_t l
 /* Erase one JesFs sector, including the required low-level checks. */
 int16_t sflash_sector_erase(uint32_t sadr)
 {
+#ifdef JESFS_CHECKPOINT
+	if (sflash_info.ckpt_live_adr) {
+		int16_t res = sflash_ckpt_invalidate();
+
+		if (res) {
+			return res;
+		}
+	}
+#endif
+#ifdef JSTAT
+	sflash_spi_stat.erases++;
+#endif
+#ifdef JESFS_WEAR
+	sflash_wear_count(sadr, SF_SECTOR_PH);
+#endif
 #if !defined(__ZEPHYR__)
 	if (sflash_wait_write_enabled()) {
 		return JESFS_ERR_WRITE_ENABLE_FAILED;
 	}
 	sflash_ll_sector_erase_4k(sadr);
-	if (sflash_wait_busy(400)) {
-		return JESFS_ERR_FLASH_TIMEOUT; /* 400 msec max page */
-	}
-	return 0;
+	return sflash_wait_ready(SF_BUSY_ERASE, 0);
 #else
+#ifdef JSTAT
+	sflash_spi_stat.transactions++;
+#endif
 	return zephyr_flash_erase(sadr, SF_SECTOR_PH);
 #endif
 }
+
+/* Erase a 32k or 64k block (aligned), e.g. a run of 'to delete' sectors. */
+int16_t sflash_block_erase(uint32_t badr, uint32_t bsize)
+{
+#ifdef JESFS_CHECKPOINT
+	if (sflash_info.ckpt_live_adr) {
+		int16_t res = sflash_ckpt_invalidate();
+
+		if (res) {
+			return res;
+		}
+	}
+#endif
+#ifdef JESFS_WEAR
+	sflash_wear_count(badr, bsize);
+#endif
+#if !defined(__ZEPHYR__)
+#ifdef JESFS_SFDP
+	if (sflash_sfdp_no_block_erase(bsize)) {
+		for (; bsize; bsize -= SF_SECTOR_PH, badr += SF_SECTOR_PH) {
+			if (sflash_wait_write_enabled()) {
+				return JESFS_ERR_WRITE_ENABLE_FAILED;
+			}
+#ifdef JSTAT
+			sflash_spi_stat.erases++;
+#endif
+			sflash_ll_sector_erase_4k(badr);
+			if (sflash_wait_ready(SF_BUSY_ERASE, 0)) {
+				return JESFS_ERR_FLASH_TIMEOUT;
+			}
+		}
+		return 0;
+	}
+#endif
+	if (sflash_wait_write_enabled()) {
+		return JESFS_ERR_WRITE_ENABLE_FAILED;
+	}
+#ifdef JSTAT
+	sflash_spi_stat.block_erases++;
+#endif
+	sflash_ll_block_erase(badr, bsize);
+	return sflash_wait_ready(SF_BUSY_BLOCK(bsize), 0);
+#else
+#ifdef JSTAT
+	sflash_spi_stat.block_erases++;
+	sflash_spi_stat.transactions++;
+#endif
+	return zephyr_flash_erase(badr, bsize);
+#endif
+}
 /* ------------------- Medium-level SPI OK ------------------------ */
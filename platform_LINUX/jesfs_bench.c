@@ -0,0 +1,995 @@
+/*******************************************************************************
+ * jesfs_bench.c: Reproducible JesFs benchmarks on the simulated flash
+ *
+ * JesFs - Jo's Embedded Serial File System
+ *
+ * Runs jesfs_start(), jesfs_open(), jesfs_write()/jesfs_read(), EOF discovery
+ * of unclosed files, jesfs_delete() and jesfs_format() on simulated disks of
+ * 512 kB..16 MB (see jesfs_ll_linux.c) and prints one CSV line per operation:
+ *
+ *   flash_id,disk_kb,op,variant,files,bytes,res,spi_transactions,
+ *   spi_bytes_rd,spi_bytes_wr,sim_us
+ *
+ * record compares random reads of a record file by skipping vs. by its
+ * sector list, seek random reads by skipping vs. by jesfs_seek(), ota an
+ * image transfer with and without jesfs_preallocate(), io (JESFS_MULTI_IO)
+ * 1-line vs. dual/quad SPI commands. wear
+ * (JESFS_WEAR) prints the highest/mean erase count of a sector as
+ * files/bytes.
+ *
+ * sim_us is the virtual time of the timing model, so results only depend on
+ * the code and the flash type, not on the host. All data is verified, a
+ * checkpoint start (JESFS_CHECKPOINT) against a full scan and after a change
+ * without jesfs_deepsleep();
+ * the exit code is 1 if any operation failed.
+ *
+ * Usage: jesfs_bench [-t 0xMMTT] [-d density]
+ *   -t: Flash type (default: Macronix MX25R 0xC228)
+ *   -d: Only this density (0x13: 512 kB .. 0x18: 16 MB)
+ *
+ * (C) joembedded@gmail.com - www.joembedded.de
+ *
+ * Version: see jesfs.h
+ *
+ *******************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jesfs.h"
+#include "jesfs_int.h" /* sflash_wait_usec(): idle time */
+
+#include "jesfs_ll_linux.h"
+
+#define BENCH_MIN_DENSITY 0x13 /* 512 kB */
+#define BENCH_MAX_DENSITY 0x18 /* 16 MB */
+
+#define BENCH_CHUNK 4096	  /* Size of a single jesfs_write()/jesfs_read() */
+#define BENCH_RECORD 16		  /* Small reads, e.g. of a record parser */
+#define BENCH_LOG_RECORD 20	  /* Small writes, e.g. of a data logger */
+#define BENCH_LOG_FILE 0x4000	  /* Size of the logger file */
+#define BENCH_RECORD_READS 256	  /* Random reads of a record file */
+#define BENCH_SEEK_CACHE 32	  /* Entries of the seek cache */
+#define BENCH_OTA_PACKET 256	  /* Packet size of an OTA transfer */
+#define BENCH_MAX_FILE 0x100000 /* Sequential file size, max. 1/4 of the disk */
+#define BENCH_SMALL_FILE 100	  /* Size of the files for the open tests */
+#define BENCH_FIXED_SECS 1700000000
+
+static const uint16_t bench_nfiles[] = { 10, 100, 1000 };
+
+static uint8_t wbuf[BENCH_CHUNK];
+static uint8_t rbuf[BENCH_CHUNK];
+static struct jesfs_desc desc;
+
+static struct ll_sim_stat stat0;
+static uint32_t bench_errors;
+
+/* Required by JesFs. Fixed time for reproducible disk contents. */
+uint32_t jesfs_time_get(void)
+{
+	return BENCH_FIXED_SECS;
+}
+
+int16_t jesfs_supply_voltage_check(void)
+{
+	return 0;
+}
+
+static void bench_begin(void)
+{
+	ll_get_stat_vdisk(&stat0);
+}
+
+/* Print the result of the operation since bench_begin(). */
+static void bench_end(const char *op, const char *variant, uint32_t files, uint32_t bytes,
+		      int32_t res)
+{
+	struct ll_sim_stat stat1;
+
+	ll_get_stat_vdisk(&stat1);
+	printf("%06X,%u,%s,%s,%u,%u,%d,%u,%llu,%llu,%llu\n", sflash_info.identification,
+	       sflash_info.total_flash_size / 1024, op, variant, files, bytes, res,
+	       stat1.spi_transactions - stat0.spi_transactions,
+	       (unsigned long long)(stat1.spi_bytes_rd - stat0.spi_bytes_rd),
+	       (unsigned long long)(stat1.spi_bytes_wr - stat0.spi_bytes_wr),
+	       (unsigned long long)(stat1.vtime_us - stat0.vtime_us));
+	if (res < 0) {
+		bench_errors++;
+	}
+}
+
+static void bench_fail(const char *op, const char *what)
+{
+	fprintf(stderr, "ERROR: %s: %s\n", op, what);
+	bench_errors++;
+}
+
+/* Reproducible file content: byte at file position pos. */
+static uint8_t bench_pattern(uint32_t pos)
+{
+	return (uint8_t)((pos * 7) ^ (pos >> 9));
+}
+
+static void bench_fill(uint32_t pos, uint32_t len)
+{
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		wbuf[i] = bench_pattern(pos + i);
+	}
+}
+
+/* Write a file of len bytes, optionally without jesfs_close(). */
+static int16_t bench_write_file(const char *fname, uint8_t flags, uint32_t len, int close)
+{
+	uint32_t pos;
+	uint32_t wlen;
+	int16_t res;
+
+	res = jesfs_open(&desc, fname, SF_OPEN_CREATE | SF_OPEN_WRITE | flags);
+	for (pos = 0; !res && pos < len; pos += wlen) {
+		wlen = len - pos;
+		if (wlen > BENCH_CHUNK) {
+			wlen = BENCH_CHUNK;
+		}
+		bench_fill(pos, wlen);
+		res = jesfs_write(&desc, wbuf, wlen);
+	}
+	if (!res && close) {
+		res = jesfs_close(&desc);
+	}
+	return res;
+}
+
+/* Read and verify a file in chunks. Returns the number of bytes or an error. */
+static int32_t bench_read_file(const char *fname, uint8_t flags, uint32_t chunk)
+{
+	uint32_t pos = 0;
+	uint32_t i;
+	int32_t res;
+
+	res = jesfs_open(&desc, fname, SF_OPEN_READ | flags);
+	if (res) {
+		return res;
+	}
+	for (;;) {
+		res = jesfs_read(&desc, rbuf, chunk);
+		if (res <= 0) {
+			break;
+		}
+		for (i = 0; i < (uint32_t)res; i++) {
+			if (rbuf[i] != bench_pattern(pos + i)) {
+				bench_fail("read", "data mismatch");
+				return pos + i;
+			}
+		}
+		pos += res;
+	}
+	if (res < 0) {
+		return res;
+	}
+	if ((flags & SF_OPEN_CRC) && desc.file_crc32 != jesfs_get_crc32(&desc)) {
+		bench_fail("read", "CRC mismatch");
+	}
+	return pos;
+}
+
+static int16_t bench_format_quiet(void)
+{
+	int16_t res = jesfs_format(FS_FORMAT_SOFT);
+	if (!res) {
+		res = jesfs_start(FS_START_NORMAL);
+	}
+	if (res) {
+		bench_fail("format", "setup failed");
+	}
+	return res;
+}
+
+/* jesfs_format() on a new disk (trash) and on an empty disk. */
+static void bench_format(void)
+{
+	int16_t res;
+
+	jesfs_start(FS_START_NORMAL); /* New disk: not formatted */
+	bench_begin();
+	res = jesfs_format(FS_FORMAT_SOFT);
+	bench_end("format", "soft_trash", 0, 0, res);
+	jesfs_start(FS_START_NORMAL);
+	bench_begin();
+	res = jesfs_format(FS_FORMAT_SOFT);
+	bench_end("format", "soft_empty", 0, 0, res);
+	jesfs_start(FS_START_NORMAL);
+	bench_begin();
+	res = jesfs_format(FS_FORMAT_SOFT | FS_FORMAT_TRUST_EMPTY);
+	bench_end("format", "soft_trusted", 0, 0, res);
+	jesfs_start(FS_START_NORMAL);
+}
+
+#ifdef JESFS_CHECKPOINT
+/* Mount state: a checkpoint must give the same as a full scan. */
+static void bench_mount_state(uint32_t *st)
+{
+	st[0] = sflash_info.available_disk_size;
+	st[1] = sflash_info.files_used;
+	st[2] = sflash_info.files_active;
+	st[3] = sflash_info.lusect_adr;
+#ifdef JSTAT
+	st[4] = sflash_info.sectors_todelete;
+	st[5] = sflash_info.sectors_clear;
+#else
+	st[4] = 0;
+	st[5] = 0;
+#endif
+}
+#endif
+
+/* Start modes and open with many files on the disk. */
+static void bench_open(uint16_t nfiles)
+{
+	char fname[FNAMELEN + 1];
+	int16_t res = 0;
+	uint16_t i;
+#ifdef JESFS_CHECKPOINT
+	uint32_t st0[6], st1[6];
+#endif
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	bench_begin();
+	for (i = 0; i < nfiles && !res; i++) {
+		sprintf(fname, "file%04u.dat", i);
+		res = bench_write_file(fname, 0, BENCH_SMALL_FILE, 1);
+	}
+	bench_end("create", "closed", nfiles, nfiles * BENCH_SMALL_FILE, res);
+	if (res) {
+		return;
+	}
+
+	jesfs_deepsleep();
+	bench_begin();
+	res = jesfs_start(FS_START_NORMAL | FS_START_FULLSCAN);
+	bench_end("start", "fullscan", nfiles, 0, res);
+#ifdef JESFS_CHECKPOINT
+	bench_mount_state(st0);
+#endif
+	jesfs_deepsleep();
+	bench_begin();
+	res = jesfs_start(FS_START_NORMAL);
+	bench_end("start", "normal", nfiles, 0, res);
+#ifdef JESFS_CHECKPOINT
+	bench_mount_state(st1);
+	if (!sflash_info.ckpt_live_adr) {
+		bench_fail("start", "checkpoint not used");
+	} else if (memcmp(st0, st1, sizeof(st0))) {
+		bench_fail("start", "checkpoint differs from the full scan");
+	}
+#endif
+	jesfs_deepsleep();
+	bench_begin();
+	res = jesfs_start(FS_START_FAST);
+	bench_end("start", "fast", nfiles, 0, res);
+	jesfs_deepsleep();
+	bench_begin();
+	res = jesfs_start(FS_START_RESTART);
+	bench_end("start", "restart", nfiles, 0, res);
+
+	bench_begin();
+	res = jesfs_open(&desc, "file0000.dat", SF_OPEN_READ);
+	bench_end("open", "first", nfiles, 0, res);
+	bench_begin();
+	res = jesfs_open(&desc, "file0000.dat", SF_OPEN_READ);
+	bench_end("open", "again", nfiles, 0, res);
+	sprintf(fname, "file%04u.dat", nfiles - 1);
+	bench_begin();
+	res = jesfs_open(&desc, fname, SF_OPEN_READ);
+	bench_end("open", "last", nfiles, 0, res);
+	bench_begin();
+	res = jesfs_open(&desc, "missing.dat", SF_OPEN_READ);
+	bench_end("open", "missing", nfiles, 0, res == JESFS_ERR_FILE_NOT_FOUND ? 0 : -1);
+
+#ifdef JESFS_CHECKPOINT
+	/* Changed after the checkpoint, then a reset without jesfs_deepsleep() */
+	res = bench_write_file("stale.dat", 0, 3 * BENCH_CHUNK, 1);
+	if (!res) {
+		res = jesfs_open(&desc, "file0000.dat", SF_OPEN_READ);
+	}
+	if (!res) {
+		res = jesfs_delete(&desc);
+	}
+	if (res) {
+		bench_fail("start", "stale setup failed");
+		return;
+	}
+	bench_mount_state(st0);
+	bench_begin();
+	res = jesfs_start(FS_START_NORMAL);
+	bench_end("start", "stale", nfiles, 0, res);
+	bench_mount_state(st1);
+	if (sflash_info.ckpt_live_adr) {
+		bench_fail("start", "stale checkpoint used");
+	} else if (memcmp(st0, st1, 3 * sizeof(st0[0]))) {
+		bench_fail("start", "full scan differs after a stale checkpoint");
+	}
+#endif
+}
+
+/* jesfs_read_stream() consumer: verify the chunk, *ctx is its file position. */
+static int16_t bench_stream_chunk(void *ctx, const uint8_t *pdata, uint16_t clen)
+{
+	uint32_t *ppos = (uint32_t *)ctx;
+	uint16_t i;
+
+	for (i = 0; i < clen; i++) {
+		if (pdata[i] != bench_pattern(*ppos + i)) {
+			bench_fail("read", "stream data mismatch");
+			return -1;
+		}
+	}
+	*ppos += clen;
+	return 0;
+}
+
+/* Sequential write/read with and without CRC, EOF of unclosed files. */
+static void bench_sequential(uint32_t flen)
+{
+	uint32_t pos;
+	int32_t res;
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	bench_begin();
+	res = bench_write_file("seq_crc.dat", SF_OPEN_CRC, flen, 1);
+	bench_end("write", "crc", 1, flen, res);
+	bench_begin();
+	res = bench_read_file("seq_crc.dat", SF_OPEN_CRC, BENCH_CHUNK);
+	bench_end("read", "crc", 1, flen, res == (int32_t)flen ? 0 : -1);
+
+	bench_begin();
+	res = bench_write_file("seq_plain.dat", 0, flen, 1);
+	bench_end("write", "plain", 1, flen, res);
+	bench_begin();
+	res = bench_read_file("seq_plain.dat", 0, BENCH_CHUNK);
+	bench_end("read", "plain", 1, flen, res == (int32_t)flen ? 0 : -1);
+	bench_begin();
+	res = bench_read_file("seq_plain.dat", 0, BENCH_RECORD);
+	bench_end("read", "rec16", 1, flen, res == (int32_t)flen ? 0 : -1);
+	bench_begin();
+	pos = 0;
+	res = jesfs_open(&desc, "seq_plain.dat", SF_OPEN_READ);
+	if (!res) {
+		res = jesfs_read_stream(&desc, 0xFFFFFFFF, bench_stream_chunk, &pos);
+	}
+	bench_end("read", "stream", 1, flen, (res == (int32_t)flen && pos == flen) ? 0 : -1);
+
+	/* Unclosed file, e.g. after a reset: EOF must be searched */
+	res = bench_write_file("unclosed.dat", 0, flen, 0);
+	if (res) {
+		bench_fail("eof", "setup failed");
+		return;
+	}
+	jesfs_deepsleep();
+	jesfs_start(FS_START_NORMAL); /* As after a reset: end unknown */
+	bench_begin();
+	res = jesfs_open(&desc, "unclosed.dat", SF_OPEN_READ);
+	if (!res) {
+		res = jesfs_read(&desc, NULL, 0xFFFFFFFF);
+	}
+	bench_end("eof", "unclosed", 1, flen, res == (int32_t)flen ? 0 : -1);
+
+	/* Append after a wake (see usecase_BlackBox) */
+	jesfs_deepsleep();
+	jesfs_start(FS_START_RESTART);
+	bench_begin();
+	res = jesfs_open(&desc, "unclosed.dat", SF_OPEN_CREATE | SF_OPEN_RAW);
+	if (!res) {
+		res = jesfs_read(&desc, NULL, 0xFFFFFFFF);
+	}
+	bench_end("eof", "wake", 1, flen, res == (int32_t)flen ? 0 : -1);
+}
+
+/* A logger: flen bytes in small records, optionally with a write buffer. */
+static void bench_log_records(uint32_t flen)
+{
+#ifdef JESFS_WRITE_BUFFER
+	static uint8_t pagebuf[256];
+#endif
+	uint32_t pos;
+	uint32_t wlen;
+	int32_t res;
+	int buffered;
+
+	for (buffered = 0; buffered < 2; buffered++) {
+		if (bench_format_quiet()) {
+			return;
+		}
+		bench_begin();
+		res = jesfs_open(&desc, "log.dat", SF_OPEN_CREATE | SF_OPEN_WRITE);
+#ifdef JESFS_WRITE_BUFFER
+		if (!res && buffered) {
+			res = jesfs_set_write_buffer(&desc, pagebuf, sizeof(pagebuf));
+		}
+#else
+		if (buffered) {
+			break;
+		}
+#endif
+		for (pos = 0; !res && pos < flen; pos += wlen) {
+			wlen = flen - pos;
+			if (wlen > BENCH_LOG_RECORD) {
+				wlen = BENCH_LOG_RECORD;
+			}
+			bench_fill(pos, wlen);
+			res = jesfs_write(&desc, wbuf, wlen);
+		}
+		if (!res) {
+			res = jesfs_close(&desc);
+		}
+		bench_end("write", buffered ? "rec20_wbuf" : "rec20", 1, flen, res);
+		res = bench_read_file("log.dat", 0, BENCH_CHUNK);
+		if (res != (int32_t)flen) {
+			bench_fail("write", "log records");
+		}
+	}
+}
+
+/* File size that uses exactly nsect sectors */
+static uint32_t bench_sectors_to_bytes(uint32_t nsect)
+{
+	return (SF_SECTOR_PH - 48) + (nsect - 1) * (SF_SECTOR_PH - 12);
+}
+
+/*
+ * Write on a full, fragmented disk: A (30%), B (30%), C (rest) fill the disk,
+ * B is deleted. After jesfs_start() the next free sector is found behind A.
+ */
+static void bench_fragmented(void)
+{
+	uint32_t nfree;
+	uint32_t na;
+	uint32_t nc;
+	int16_t res;
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	nfree = sflash_info.available_disk_size / SF_SECTOR_PH; /* JESFS_WEAR: minus the table */
+	na = nfree * 3 / 10;
+	nc = nfree - 2 * na;
+	res = bench_write_file("frag_a.dat", 0, bench_sectors_to_bytes(na), 1);
+	if (!res) {
+		res = bench_write_file("frag_b.dat", 0, bench_sectors_to_bytes(na), 1);
+	}
+	if (!res) {
+		res = bench_write_file("frag_c.dat", 0, bench_sectors_to_bytes(nc), 1);
+	}
+	if (!res) {
+		res = jesfs_open(&desc, "frag_b.dat", SF_OPEN_READ);
+	}
+	if (!res) {
+		res = jesfs_delete(&desc);
+	}
+	if (!res) {
+		res = jesfs_start(FS_START_NORMAL);
+	}
+	if (res) {
+		bench_fail("fragmented", "setup failed");
+		return;
+	}
+	bench_begin();
+	res = bench_write_file("frag_d.dat", 0, 4 * BENCH_CHUNK, 1);
+	bench_end("write", "fragmented", 1, 4 * BENCH_CHUNK, res);
+}
+
+/* Delete a file of half the disk size. */
+static void bench_delete(uint32_t flen)
+{
+#if defined(JESFS_GC) && defined(JESFS_ASYNC_ERASE)
+	struct jesfs_spi_stat sstat0, sstat1;
+#endif
+	int16_t res;
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	res = bench_write_file("large.dat", 0, flen, 1);
+	if (res) {
+		bench_fail("delete", "setup failed");
+		return;
+	}
+	bench_begin();
+	res = jesfs_open(&desc, "large.dat", SF_OPEN_READ);
+	if (!res) {
+		res = jesfs_delete(&desc);
+	}
+	bench_end("delete", "large", 1, flen, res);
+
+	/* The next write erases deleted sectors on the way */
+	bench_begin();
+	res = bench_write_file("after_del.dat", 0, 4 * BENCH_CHUNK, 1);
+	bench_end("write", "deleted", 1, 4 * BENCH_CHUNK, res);
+#ifdef JESFS_GC
+#ifdef JESFS_ASYNC_ERASE
+	/* Reading while jesfs_gc() erases in the background */
+	bench_begin();
+	res = bench_read_file("after_del.dat", 0, BENCH_CHUNK);
+	bench_end("read", "idle", 1, 4 * BENCH_CHUNK, res < 0 ? res : 0);
+	res = jesfs_gc(1);
+	bench_begin();
+	res = res < 0 ? res : bench_read_file("after_del.dat", 0, BENCH_CHUNK);
+	bench_end("read", "erasing", 1, 4 * BENCH_CHUNK, res < 0 ? res : 0);
+
+	/* Idle loop: poll every msec */
+	jesfs_get_spi_stat(&sstat0);
+	bench_begin();
+	while ((res = jesfs_gc(0xFFFF)) > 0) {
+		sflash_wait_usec(1000);
+	}
+	jesfs_get_spi_stat(&sstat1);
+	bench_end("gc", "all",
+		  sstat1.erases - sstat0.erases +
+			  (sstat1.block_erases - sstat0.block_erases) * (0x10000 / SF_SECTOR_PH),
+		  0, res);
+#else
+	/* Unless jesfs_gc() erased them before (in idle time) */
+	bench_begin();
+	res = jesfs_gc(0xFFFF);
+	bench_end("gc", "all", res, 0, res < 0 ? res : 0);
+#endif
+	bench_begin();
+	res = bench_write_file("after_gc.dat", 0, 4 * BENCH_CHUNK, 1);
+	bench_end("write", "gc", 1, 4 * BENCH_CHUNK, res);
+#endif
+}
+
+/*
+ * A logger keeping the last BENCH_LOG_FILE bytes, written in records after a
+ * wake (see usecase_BlackBox): 'rename' shifts the full file to a second one,
+ * 'drop' is a ring file (jesfs_open_ring()).
+ */
+static void bench_ring(uint32_t total)
+{
+	struct jesfs_desc desc2;
+	uint32_t pos;
+	uint32_t kept;
+	uint32_t i;
+	int32_t res;
+	int ring;
+
+	for (ring = 0; ring < 2; ring++) {
+		if (bench_format_quiet()) {
+			return;
+		}
+		res = 0;
+		bench_begin();
+		for (pos = 0; !res && pos < total; pos += BENCH_LOG_RECORD) {
+			if (!(pos % (16 * BENCH_LOG_RECORD))) {
+				/* Reopen every 16 records, e.g. after a wake */
+				if (ring) {
+					res = jesfs_open_ring(&desc, "log.dat", SF_OPEN_RAW,
+							      BENCH_LOG_FILE);
+				} else {
+					res = jesfs_open(&desc, "log.dat",
+							 SF_OPEN_CREATE | SF_OPEN_RAW);
+				}
+				if (!res) {
+					res = jesfs_read(&desc, NULL, 0xFFFFFFFF);
+					res = (res < 0) ? res : 0;
+				}
+			}
+			bench_fill(pos, BENCH_LOG_RECORD);
+			if (!res) {
+				res = jesfs_write(&desc, wbuf, BENCH_LOG_RECORD);
+			}
+			if (!res && !ring && desc.file_len >= BENCH_LOG_FILE) {
+				res = jesfs_open(&desc2, "log.sec", SF_OPEN_CREATE);
+				if (!res) {
+					res = jesfs_rename(&desc, &desc2);
+				}
+				if (!res) {
+					res = jesfs_open(&desc, "log.dat", SF_OPEN_CREATE | SF_OPEN_RAW);
+				}
+			}
+		}
+		bench_end("ring", ring ? "drop" : "rename", pos / BENCH_LOG_RECORD, pos, res);
+		if (!ring) {
+			continue;
+		}
+		/* The newest data, at least BENCH_LOG_FILE bytes */
+		res = jesfs_open(&desc, "log.dat", SF_OPEN_READ);
+		for (kept = 0; !res && (res = jesfs_read(&desc, rbuf, BENCH_CHUNK)) > 0;) {
+			kept += res;
+			res = 0;
+		}
+		if (res < 0 || kept < BENCH_LOG_FILE) {
+			bench_fail("ring", "length");
+			continue;
+		}
+		jesfs_rewind(&desc);
+		for (i = 0; i < kept; i += res) {
+			res = jesfs_read(&desc, rbuf, BENCH_CHUNK);
+			if (res <= 0 || rbuf[0] != bench_pattern(pos - kept + i) ||
+			    rbuf[res - 1] != bench_pattern(pos - kept + i + res - 1)) {
+				bench_fail("ring", "data mismatch");
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * A record file (jesfs_open_record()) of flen bytes, then BENCH_RECORD_READS
+ * records at pseudo-random positions: 'scan' skips from the start with
+ * jesfs_read(NULL), 'index' uses jesfs_read_record().
+ */
+static void bench_record(uint32_t flen)
+{
+	uint32_t nrec = flen / BENCH_LOG_RECORD;
+	uint32_t seed;
+	uint32_t n;
+	uint32_t i;
+	int32_t res;
+	int indexed;
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	bench_begin();
+	res = jesfs_open_record(&desc, "rec.dat", SF_OPEN_WRITE, BENCH_LOG_RECORD);
+	for (n = 0; !res && n < nrec; n++) {
+		bench_fill(n * BENCH_LOG_RECORD, BENCH_LOG_RECORD);
+		res = jesfs_append_record(&desc, wbuf);
+	}
+	if (!res) {
+		res = jesfs_close(&desc);
+	}
+	bench_end("record", "append", nrec, nrec * BENCH_LOG_RECORD, res);
+
+	for (indexed = 0; indexed < 2; indexed++) {
+		bench_begin();
+		res = jesfs_open(&desc, "rec.dat", SF_OPEN_READ);
+		if (!res && jesfs_record_count(&desc) != (int32_t)nrec) {
+			res = -1;
+		}
+		for (i = 0, seed = 1; !res && i < BENCH_RECORD_READS; i++) {
+			seed = seed * 1103515245 + 12345;
+			n = (seed >> 8) % nrec;
+			if (indexed) {
+				res = jesfs_read_record(&desc, n, rbuf);
+			} else {
+				res = jesfs_rewind(&desc);
+				if (!res) {
+					res = jesfs_read(&desc, NULL, n * BENCH_LOG_RECORD);
+				}
+				if (res == (int32_t)(n * BENCH_LOG_RECORD)) {
+					res = jesfs_read(&desc, rbuf, BENCH_LOG_RECORD);
+				}
+			}
+			if (res != BENCH_LOG_RECORD) {
+				res = (res < 0) ? res : -1;
+				break;
+			}
+			res = 0;
+			if (rbuf[0] != bench_pattern(n * BENCH_LOG_RECORD) ||
+			    rbuf[BENCH_LOG_RECORD - 1] !=
+				    bench_pattern(n * BENCH_LOG_RECORD + BENCH_LOG_RECORD - 1)) {
+				bench_fail("record", "data mismatch");
+				break;
+			}
+		}
+		bench_end("record", indexed ? "index" : "scan", BENCH_RECORD_READS,
+			  BENCH_RECORD_READS * BENCH_LOG_RECORD, res);
+	}
+}
+
+/*
+ * An OTA image of flen bytes, received in packets of BENCH_OTA_PACKET bytes,
+ * on a full disk with the sectors of the old image deleted: 'transfer' allocates
+ * (and erases) on the way, with jesfs_preallocate() ('preallocate') before,
+ * 'transfer_pre' only programs pages.
+ */
+static void bench_ota(uint32_t flen)
+{
+	uint32_t nsect;
+	uint32_t pos;
+	uint32_t wlen;
+	int32_t res;
+	int pre;
+
+	for (pre = 0; pre < 2; pre++) {
+		if (bench_format_quiet()) {
+			return;
+		}
+		/* The rest of the disk is used */
+		nsect = sflash_info.available_disk_size / SF_SECTOR_PH -
+			(flen + SF_SECTOR_PH - 1) / (SF_SECTOR_PH - 12) - 3;
+		res = bench_write_file("fill.bin", 0, bench_sectors_to_bytes(nsect), 1);
+		if (!res) {
+			res = bench_write_file("ota.bin", 0, flen, 1);
+		}
+		if (!res) {
+			res = jesfs_open(&desc, "ota.bin", SF_OPEN_READ);
+		}
+		if (!res) {
+			res = jesfs_delete(&desc);
+		}
+		if (!res) {
+			res = jesfs_open(&desc, "ota.bin", SF_OPEN_CREATE | SF_OPEN_WRITE);
+		}
+		if (res) {
+			bench_fail("ota", "setup failed");
+			return;
+		}
+		if (pre) {
+			bench_begin();
+			res = jesfs_preallocate(&desc, flen);
+			bench_end("ota", "preallocate", 1, flen, res);
+		}
+		bench_begin();
+		for (pos = 0; !res && pos < flen; pos += wlen) {
+			wlen = flen - pos;
+			if (wlen > BENCH_OTA_PACKET) {
+				wlen = BENCH_OTA_PACKET;
+			}
+			bench_fill(pos, wlen);
+			res = jesfs_write(&desc, wbuf, wlen);
+		}
+		if (!res) {
+			res = jesfs_close(&desc);
+		}
+		bench_end("ota", pre ? "transfer_pre" : "transfer", 1, flen, res);
+		res = bench_read_file("ota.bin", 0, BENCH_CHUNK);
+		if (res != (int32_t)flen) {
+			bench_fail("ota", "image");
+		}
+	}
+}
+
+#ifdef JESFS_MULTI_IO
+/*
+ * Write and read a flen file with 1-line SPI ('1line', see ll_set_io_vdisk())
+ * and with the multi-line commands of the flash type ('multi').
+ */
+static void bench_multi_io(uint32_t flen)
+{
+	static const char *const variants[] = { "1line", "multi" };
+	int32_t res;
+	int v;
+
+	for (v = 0; v < 2; v++) {
+		ll_set_io_vdisk(v ? 0xFF : 0);
+		jesfs_start(FS_START_NORMAL); /* Selects the commands */
+		if (bench_format_quiet()) {
+			break;
+		}
+		bench_begin();
+		res = bench_write_file("io.dat", 0, flen, 1);
+		bench_end("io_write", variants[v], 1, flen, res);
+		bench_begin();
+		res = bench_read_file("io.dat", 0, BENCH_CHUNK);
+		bench_end("io_read", variants[v], 1, flen, res == (int32_t)flen ? 0 : -1);
+	}
+	ll_set_io_vdisk(0xFF);
+	jesfs_start(FS_START_NORMAL);
+}
+#endif
+
+/*
+ * BENCH_RECORD_READS reads of BENCH_RECORD bytes at pseudo-random positions
+ * of a flen file (e.g. resources): 'skip' rewinds and skips with
+ * jesfs_read(NULL), 'seek' uses jesfs_seek(), 'cache' with a seek cache of
+ * BENCH_SEEK_CACHE entries (JESFS_SEEK_CACHE).
+ */
+static void bench_seek(uint32_t flen)
+{
+#ifdef JESFS_SEEK_CACHE
+	static uint32_t seek_cache[BENCH_SEEK_CACHE];
+#endif
+	static const char *const variants[] = { "skip", "seek", "cache" };
+	uint32_t seed;
+	uint32_t pos;
+	uint32_t i;
+	int32_t res;
+	int v;
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	if (bench_write_file("res.bin", 0, flen, 1)) {
+		bench_fail("seek", "write");
+		return;
+	}
+	for (v = 0; v < 3; v++) {
+		bench_begin();
+		res = jesfs_open(&desc, "res.bin", SF_OPEN_READ);
+#ifdef JESFS_SEEK_CACHE
+		if (!res && v == 2) {
+			res = jesfs_set_seek_cache(&desc, seek_cache, BENCH_SEEK_CACHE);
+		}
+#else
+		if (v == 2) {
+			break;
+		}
+#endif
+		for (i = 0, seed = 1; !res && i < BENCH_RECORD_READS; i++) {
+			seed = seed * 1103515245 + 12345;
+			pos = (seed >> 8) % (flen - BENCH_RECORD);
+			if (v) {
+				res = jesfs_seek(&desc, pos);
+			} else {
+				res = jesfs_rewind(&desc);
+				if (!res) {
+					res = jesfs_read(&desc, NULL, pos);
+				}
+			}
+			if (res == (int32_t)pos) {
+				res = jesfs_read(&desc, rbuf, BENCH_RECORD);
+			}
+			if (res != BENCH_RECORD) {
+				res = (res < 0) ? res : -1;
+				break;
+			}
+			res = 0;
+			if (rbuf[0] != bench_pattern(pos) ||
+			    rbuf[BENCH_RECORD - 1] != bench_pattern(pos + BENCH_RECORD - 1)) {
+				bench_fail("seek", "data mismatch");
+				break;
+			}
+		}
+		bench_end("seek", variants[v], BENCH_RECORD_READS, BENCH_RECORD_READS * BENCH_RECORD,
+			  res);
+	}
+}
+
+#ifdef JESFS_WEAR
+/*
+ * A logger next to static data (4 files, half the disk): log files of 8
+ * sectors, the oldest of 4 is deleted. 'level' calls jesfs_wear_level() every
+ * 64 files. files/bytes: the highest erase count of a data sector (heads stay
+ * at their index entry, see jesfs.h) and the mean of all sectors in this run.
+ */
+static void bench_wear(uint32_t dsize, uint8_t level)
+{
+	static uint16_t cnt0[SF_WEAR_SECTORS];
+	uint32_t nsect = dsize / SF_SECTOR_PH;
+	uint32_t nlogs = nsect * 2;
+	uint32_t esum = 0;
+	uint32_t emax = 0;
+	uint32_t cnt;
+	uint32_t magic;
+	uint32_t i;
+	char fname[16];
+	int32_t res;
+
+	if (bench_format_quiet()) {
+		return;
+	}
+	for (i = 0, res = 0; !res && i < 4; i++) {
+		sprintf(fname, "static%u.dat", i);
+		res = bench_write_file(fname, 0, dsize / 8, 1);
+	}
+	memcpy(cnt0, sflash_wear_cnt, sizeof(cnt0));
+	bench_begin();
+	for (i = 0; !res && i < nlogs; i++) {
+		sprintf(fname, "log%u.dat", i % 5);
+		res = bench_write_file(fname, 0, 8 * (SF_SECTOR_PH - HEADER_SIZE_B), 1);
+		sprintf(fname, "log%u.dat", (i + 1) % 5);
+		if (!res && !jesfs_open(&desc, fname, SF_OPEN_READ)) {
+			res = jesfs_delete(&desc);
+		}
+		if (!res && level && (i & 63) == 63) {
+			res = jesfs_wear_level(1, 32);
+			res = (res < 0) ? res : 0;
+		}
+	}
+	for (i = 1; i < nsect; i++) {
+		cnt = (uint16_t)(sflash_wear_cnt[i] - cnt0[i]);
+		esum += cnt;
+		if (!res && sflash_read(i * SF_SECTOR_PH, (uint8_t *)&magic, 4) == 0 &&
+		    (magic == SECTOR_MAGIC_HEAD_ACTIVE || magic == SECTOR_MAGIC_HEAD_DELETED)) {
+			continue;
+		}
+		emax = (cnt > emax) ? cnt : emax;
+	}
+	bench_end("wear", level ? "level" : "alloc", emax, esum / (nsect - 1), res);
+	for (i = 0; i < 4; i++) {
+		sprintf(fname, "static%u.dat", i);
+		if (bench_read_file(fname, 0, BENCH_CHUNK) != (int32_t)(dsize / 8)) {
+			bench_fail("wear", "static data");
+		}
+	}
+}
+#endif
+
+static void bench_disk(uint32_t id)
+{
+	uint32_t dsize = 1UL << (id & 255);
+	uint32_t nsect = dsize / SF_SECTOR_PH;
+	uint32_t flen;
+	uint16_t i;
+	int16_t res;
+
+	ll_setid_vdisk(id); /* Next jesfs_start() uses a new disk */
+	bench_format();
+
+	for (i = 0; i < sizeof(bench_nfiles) / sizeof(bench_nfiles[0]); i++) {
+		if (bench_nfiles[i] + 2 > nsect) {
+			continue; /* Does not fit */
+		}
+		bench_open(bench_nfiles[i]);
+	}
+
+	flen = dsize / 4;
+	if (flen > BENCH_MAX_FILE) {
+		flen = BENCH_MAX_FILE;
+	}
+	bench_sequential(flen);
+	bench_log_records(BENCH_LOG_FILE);
+	bench_fragmented();
+	bench_delete(dsize / 2);
+	bench_ring(8 * BENCH_LOG_FILE);
+	bench_record(flen);
+	bench_seek(flen);
+	bench_ota(flen);
+#ifdef JESFS_MULTI_IO
+	bench_multi_io(flen);
+#endif
+#ifdef JESFS_WEAR
+	bench_wear(dsize, 0);
+	bench_wear(dsize, 1);
+#endif
+
+	bench_begin();
+	res = jesfs_check_disk(NULL);
+	bench_end("check_disk", "-", sflash_info.files_used, 0, res);
+	if (res) {
+		bench_errors++; /* Also non-critical errors */
+	}
+	jesfs_deepsleep();
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t type = MACRONIX_MANU_TYP_RX;
+	uint32_t dmin = BENCH_MIN_DENSITY;
+	uint32_t dmax = BENCH_MAX_DENSITY;
+	uint32_t d;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:h")) != -1) {
+		switch (opt) {
+		case 't':
+			type = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			dmin = dmax = strtoul(optarg, NULL, 0);
+			if (dmin < BENCH_MIN_DENSITY || dmin > BENCH_MAX_DENSITY) {
+				fprintf(stderr, "Density 0x%X..0x%X\n", BENCH_MIN_DENSITY,
+					BENCH_MAX_DENSITY);
+				return 2;
+			}
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t 0xMMTT] [-d density]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	unsetenv("JESFS_VDISK"); /* Always a new disk in RAM */
+	jesfs_set_static_secs(BENCH_FIXED_SECS);
+
+	printf("flash_id,disk_kb,op,variant,files,bytes,res,spi_transactions,"
+	       "spi_bytes_rd,spi_bytes_wr,sim_us\n");
+	for (d = dmin; d <= dmax; d++) {
+		bench_disk((type << 8) | d);
+	}
+	if (bench_errors) {
+		fprintf(stderr, "%u ERROR(s)\n", bench_errors);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,812 @@
+/*******************************************************************************
+ * jesfs_ll_linux.c: JesFs low-level flash simulation for Linux hosts
+ *
+ * JesFs - Jo's Embedded Serial File System
+ *
+ * Simulates a SPI NOR flash behind the bare-metal low-level interface
+ * (sflash_spi_read(), sflash_spi_write(), sflash_select(), ...), so the
+ * unmodified JesFs core runs natively on Linux, e.g. in CI or on a back-end
+ * that inspects device images.
+ *
+ * The flash content is an mmap()ed image file (see ll_open_vdisk() or the
+ * environment variable JESFS_VDISK). Byte 0 of the file is flash address 0,
+ * the same raw format as ll_write_vdisk() of the Windows simulation. Without
+ * an image file the disk lives in anonymous memory.
+ *
+ * Timing: all operations complete at once, but a virtual clock advances with
+ * the SPI transfers, sflash_wait_usec() and the (typical) datasheet times of
+ * the simulated flash type. The status register shows WIP until the virtual
+ * clock passes the end of a program/erase, so host runs show the same busy
+ * polling as a real device, and ll_get_vtime_us() predicts its runtime.
+ *
+ * Fast, dual and quad reads and quad page programs (see sflash_spi_io_caps())
+ * are accepted as far as the flash type has them, their data (0xEB/0x38: also
+ * the address) is clocked on 2 or 4 lines.
+ *
+ * The SFDP (0x5A) of the flash is built from its timing, commands and size,
+ * see ll_set_sfdp_vdisk(). Unknown types are simulated as MX25R.
+ *
+ * (C) joembedded@gmail.com - www.joembedded.de
+ *
+ * Version: see jesfs.h
+ *
+ *******************************************************************************/
+
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jesfs.h"
+#include "jesfs_int.h"
+
+#include "jesfs_ll_linux.h"
+
+/* Fast exit on simulation errors: a real flash would silently misbehave. */
+#define sim_assert(p) ((p) ? (void)0 : sim_assert_failed(#p, __LINE__))
+
+static void sim_assert_failed(const char *pc, int ln)
+{
+	fprintf(stderr, "<LL: ASSERTION FAILED: '%s' Line %d>\n", pc, ln);
+	exit(-1);
+}
+
+/*
+ * Default ID of the simulated disk: Macronix MX25R, density is the last byte
+ * as 2^DD bytes (0x13: 512 kB).
+ */
+#define SIM_DISK_ID ((MACRONIX_MANU_TYP_RX << 8) + 0x13)
+
+/* Required and simulated SPI commands. */
+#define CMD_DEEPPOWERDOWN 0xB9
+#define CMD_RELEASEDPD 0xAB
+#define CMD_RDID 0x9F
+#define CMD_WRITEENABLE 0x06
+#define CMD_STATUSREG 0x05
+#define CMD_READDATA 0x03
+#define CMD_BULKERASE 0xC7
+#define CMD_PAGEWRITE 0x02
+#define CMD_SECTOR4K_ERASE 0x20
+#define CMD_BLOCK32K_ERASE 0x52
+#define CMD_BLOCK64K_ERASE 0xD8
+#define CMD_ERASE_SUSPEND 0x75
+#define CMD_ERASE_RESUME 0x7A
+#define CMD_ERASE_SUSPEND_SFDP 0xB0 /* MX25R also, as in the SFDP */
+#define CMD_ERASE_RESUME_SFDP 0x30
+#define CMD_FASTREAD 0x0B
+#define CMD_DUALREAD 0x3B
+#define CMD_QUADREAD 0x6B
+#define CMD_QUADIOREAD 0xEB
+#define CMD_QUADPAGEWRITE 0x32
+#define CMD_QUADIOPAGEWRITE 0x38
+#define CMD_READ_SFDP 0x5A
+
+/* Status register bits. */
+#define SR_WIP 1 /* Write in progress */
+#define SR_WEL 2 /* Write enable latch */
+
+/*
+ * Typical datasheet timings per flash type (ll_sim_timing, times in usec).
+ * Program/erase times are 'typical', the SPI clock is the usual nRF52 SPI
+ * setting. Change with ll_set_timing_vdisk() for other setups.
+ */
+static const struct sim_type {
+	uint32_t manu_typ; /* 0xMMTT */
+	struct ll_sim_timing timing;
+	uint8_t io_caps; /* Multi-line commands (SF_IO_xxx) */
+} sim_types[] = {
+	/* MX25R (e.g. MX25R6435F) in low power mode */
+	{ MACRONIX_MANU_TYP_RX,
+	  { .spi_hz = 8000000, .t_bp_us = 32, .t_pp_us = 850, .t_se_us = 40000,
+	    .t_be32_us = 240000, .t_be64_us = 480000, .t_ce_ms_mb = 7000, .t_res_us = 35, .t_sus_us = 20 },
+	  SF_IO_FAST_READ | SF_IO_DUAL_OUT | SF_IO_QUAD_OUT | SF_IO_QUAD_IO | SF_IO_QUAD_IO_PP },
+	/* GD25WD (e.g. GD25WD80C): no quad */
+	{ GIGADEV_MANU_TYP_WD,
+	  { .spi_hz = 8000000, .t_bp_us = 30, .t_pp_us = 600, .t_se_us = 50000,
+	    .t_be32_us = 150000, .t_be64_us = 250000, .t_ce_ms_mb = 4000, .t_res_us = 20, .t_sus_us = 20 },
+	  SF_IO_FAST_READ | SF_IO_DUAL_OUT },
+	/* GD25WQ (e.g. GD25WQ64E) */
+	{ GIGADEV_MANU_TYP_WQ,
+	  { .spi_hz = 8000000, .t_bp_us = 30, .t_pp_us = 500, .t_se_us = 45000,
+	    .t_be32_us = 150000, .t_be64_us = 250000, .t_ce_ms_mb = 5000, .t_res_us = 20, .t_sus_us = 30 },
+	  SF_IO_FAST_READ | SF_IO_DUAL_OUT | SF_IO_QUAD_OUT | SF_IO_QUAD_IO | SF_IO_QUAD_PP },
+};
+
+/* Command state: what the next transfer after the command byte means. */
+enum sim_state {
+	SIM_CMD = 0,	     /* Next write is a command */
+	SIM_PROGRAM = 1,     /* Next write is page data */
+	SIM_DONE = 2,	     /* Command complete, only deselect may follow */
+	SIM_RD_ID = 128,     /* Reads >= 128 */
+	SIM_RD_STATUS = 129,
+	SIM_RD_DATA = 130,
+	SIM_RD_SFDP = 131,
+};
+
+struct sim_flash {
+	uint32_t id_set;  /* Requested ID, 0: SIM_DISK_ID */
+	uint32_t id_used; /* ID of the mapped disk */
+	uint8_t *pmem;
+	uint32_t memsize;
+	int fd; /* Image file, -1: anonymous memory */
+	uint32_t adr_ptr;
+	uint8_t state;
+	uint8_t select;
+	uint8_t powerdown;
+	uint8_t status_reg;
+	uint8_t lines;	 /* Data lines of the current command */
+	uint8_t io_caps; /* Of the flash type */
+	uint8_t io_mask; /* ll_set_io_vdisk() */
+	uint8_t sfdp;	 /* LL_SFDP_xxx */
+
+	struct ll_sim_timing timing; /* Of the mapped disk */
+	uint8_t timing_set;	     /* Set by ll_set_timing_vdisk() */
+	uint64_t vtime_ns;	     /* Virtual clock */
+	uint64_t busy_until_ns;	     /* WIP while vtime_ns < busy_until_ns */
+	uint64_t wake_until_ns;	     /* Release from deep power down */
+	uint32_t erase_adr;	     /* Sector/block of the last erase */
+	uint32_t erase_size;
+	uint8_t erasing;	     /* Sector/block erase running or suspended */
+	uint8_t suspended;	     /* Erase suspended */
+	uint64_t erase_rest_ns;	     /* Remaining erase time while suspended */
+
+	uint32_t spi_transactions; /* Counts sflash_select() */
+	uint64_t spi_bytes_rd;
+	uint64_t spi_bytes_wr;
+};
+
+static struct sim_flash sim_flash = {
+	.fd = -1,
+	.io_mask = 0xFF,
+	.sfdp = LL_SFDP_FULL,
+};
+
+/* A new disk is filled with 'trash', so it must be formatted first. */
+static void sim_fill_trash(void)
+{
+	uint32_t i;
+	for (i = 0; i < sim_flash.memsize; i++) {
+		sim_flash.pmem[i] = (uint8_t)(i + 0x55);
+	}
+}
+
+static int16_t sim_map_anonymous(void)
+{
+	void *p = mmap(NULL, sim_flash.memsize, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return LL_VDISK_ERR_MAP;
+	}
+	sim_flash.pmem = p;
+	sim_fill_trash();
+	return 0;
+}
+
+/*
+ * Select the timing and the commands of the current ID, unknown types use the
+ * MX25R values.
+ */
+static void sim_select_timing(void)
+{
+	const struct sim_type *pt = &sim_types[0];
+	uint32_t i;
+
+	for (i = 0; i < sizeof(sim_types) / sizeof(sim_types[0]); i++) {
+		if (sim_types[i].manu_typ == (sim_flash.id_used >> 8)) {
+			pt = &sim_types[i];
+		}
+	}
+	sim_flash.io_caps = pt->io_caps;
+	if (!sim_flash.timing_set) {
+		sim_flash.timing = pt->timing;
+	}
+}
+
+/* SPI transfer time of len bytes on 1, 2 or 4 lines. */
+static void sim_spi_clock(uint32_t len, uint8_t lines)
+{
+	sim_flash.vtime_ns +=
+		(uint64_t)len * (8 / lines) * 1000000000 / sim_flash.timing.spi_hz;
+}
+
+/* Flash is busy for usec (program/erase). */
+static void sim_set_busy(uint64_t usec)
+{
+	sim_flash.busy_until_ns = sim_flash.vtime_ns + usec * 1000;
+	sim_flash.status_reg |= SR_WIP;
+}
+
+static int sim_is_busy(void)
+{
+	if (sim_flash.vtime_ns >= sim_flash.busy_until_ns) {
+		sim_flash.status_reg &= ~SR_WIP;
+		if (!sim_flash.suspended) {
+			sim_flash.erasing = 0;
+		}
+	}
+	return sim_flash.status_reg & SR_WIP;
+}
+
+/* ------------------- Low-level SPI start ------------------------ */
+int16_t sflash_spi_init(void)
+{
+	int16_t res;
+	const char *fname;
+
+	if (!sim_flash.id_set) {
+		sim_flash.id_set = SIM_DISK_ID;
+	}
+	/* A new ID requires a new disk. */
+	if (sim_flash.pmem && sim_flash.id_set != sim_flash.id_used) {
+		ll_close_vdisk();
+	}
+	if (!sim_flash.pmem) {
+		fname = getenv("JESFS_VDISK");
+		if (fname && *fname) {
+			res = ll_open_vdisk(fname);
+		} else {
+			sim_flash.id_used = sim_flash.id_set;
+			sim_flash.memsize = 1UL << (sim_flash.id_used & 255);
+			res = sim_map_anonymous();
+		}
+		if (res) {
+			return JESFS_ERR_SPI_INIT;
+		}
+		sim_select_timing();
+	}
+	sim_flash.state = SIM_CMD;
+	sim_flash.select = 0;
+	return 0;
+}
+
+void sflash_spi_close(void)
+{
+	/* The mapping stays, like a powered-down flash keeps its data. */
+}
+
+void sflash_wait_usec(uint32_t usec)
+{
+	sim_flash.vtime_ns += (uint64_t)usec * 1000; /* Virtual time only */
+}
+
+void sflash_select(void)
+{
+	sim_assert(sim_flash.pmem);
+	sim_assert(!sim_flash.select);
+	sim_flash.select = 1;
+	sim_flash.spi_transactions++;
+	sim_flash.state = SIM_CMD; /* Starts with a command */
+	sim_flash.lines = 1;
+}
+
+void sflash_deselect(void)
+{
+	sim_flash.select = 0;
+}
+
+/*
+ * SFDP time field: count.cnt_bits, then the index of the smallest unit in
+ * which (count + 1) * unit >= usec fits.
+ */
+static uint32_t sim_sfdp_time(uint32_t usec, const uint32_t *units, uint8_t nunits, uint8_t cnt_bits)
+{
+	uint32_t cnt;
+	uint8_t u;
+
+	for (u = 0; u < nunits - 1; u++) {
+		if ((usec + units[u] - 1) / units[u] <= (1UL << cnt_bits)) {
+			break;
+		}
+	}
+	cnt = (usec + units[u] - 1) / units[u];
+	if (cnt) {
+		cnt--;
+	}
+	if (cnt >= (1UL << cnt_bits)) {
+		cnt = (1UL << cnt_bits) - 1;
+	}
+	return cnt | ((uint32_t)u << cnt_bits);
+}
+
+/*
+ * SFDP of the flash (JESD216B): header, the parameter header of the Basic
+ * Flash Parameter Table (BFPT) and the BFPT at 0x10 (16 DWORDs). DWORDs
+ * 12-16 (suspend, deep power down, QE, 4-byte) are those of the MX25R6435F.
+ */
+#define SIM_SFDP_SIZE (0x10 + 16 * 4)
+static void sim_sfdp_build(uint8_t *p)
+{
+	static const uint32_t erase_units[4] = { 1000, 16000, 128000, 1000000 };
+	static const uint32_t pp_units[2] = { 8, 64 };
+	static const uint32_t byte_units[2] = { 1, 8 };
+	static const uint32_t chip_units[4] = { 16000, 256000, 4000000, 64000000 };
+	const struct ll_sim_timing *pt = &sim_flash.timing;
+	uint8_t caps = sim_flash.io_caps;
+	uint32_t dw[16];
+	uint32_t i;
+
+	dw[0] = 0xFF8020E5; /* Uniform 4k erase 0x20, 3-byte addresses */
+	if (caps & SF_IO_DUAL_OUT) {
+		dw[0] |= 1UL << 16;
+	}
+	if (caps & SF_IO_QUAD_IO) {
+		dw[0] |= 1UL << 21;
+	}
+	if (caps & SF_IO_QUAD_OUT) {
+		dw[0] |= 1UL << 22;
+	}
+	dw[1] = sim_flash.memsize * 8 - 1; /* Density in bits - 1 */
+	dw[2] = ((caps & SF_IO_QUAD_OUT) ? 0x6B08UL << 16 : 0) | ((caps & SF_IO_QUAD_IO) ? 0xEB44 : 0);
+	dw[3] = (caps & SF_IO_DUAL_OUT) ? 0x3B08 : 0;
+	dw[4] = 0xFFFFFFEE; /* No 2-2-2/4-4-4 */
+	dw[5] = 0x0000FFFF;
+	dw[6] = 0x0000FFFF;
+	if (sim_flash.sfdp == LL_SFDP_NO_BLOCKS) {
+		dw[7] = 0x0000200C; /* 4k: 0x20 */
+		dw[8] = 0;
+	} else {
+		dw[7] = 0x520F200C; /* 4k: 0x20, 32k: 0x52 */
+		dw[8] = 0xFF00D810; /* 64k: 0xD8 */
+	}
+	dw[9] = 3 | /* Max. erase time: 8 * typical */
+		sim_sfdp_time(pt->t_se_us, erase_units, 4, 5) << 4;
+	if (sim_flash.sfdp != LL_SFDP_NO_BLOCKS) {
+		dw[9] |= sim_sfdp_time(pt->t_be32_us, erase_units, 4, 5) << 11 |
+			 sim_sfdp_time(pt->t_be64_us, erase_units, 4, 5) << 18;
+	}
+	dw[10] = 2 | (8 << 4) | /* Max. program time: 6 * typical, 256 byte pages */
+		 sim_sfdp_time(pt->t_pp_us, pp_units, 2, 5) << 8 |
+		 sim_sfdp_time(pt->t_bp_us, byte_units, 2, 4) << 14 |
+		 sim_sfdp_time((pt->t_pp_us - pt->t_bp_us + 254) / 255, byte_units, 2, 4) << 19 |
+		 sim_sfdp_time(pt->t_ce_ms_mb * (sim_flash.memsize / 1024) / 1024 * 1000, chip_units, 4, 5) << 24;
+	dw[11] = 0x44488344;
+	dw[12] = 0xB030B030;
+	dw[13] = 0x5CD5C4F7;
+	dw[14] = 0xFF29BE00;
+	dw[15] = 0xFFFFD0F0;
+
+	memcpy(p, "SFDP", 4);
+	p[4] = 0x06; /* JESD216B: 1.6, 1 parameter header */
+	p[5] = 0x01;
+	p[6] = 0x00;
+	p[7] = 0xFF;
+	p[8] = 0x00; /* BFPT: ID 0xFF00, 1.6, 16 DWORDs at 0x10 */
+	p[9] = 0x06;
+	p[10] = 0x01;
+	p[11] = 16;
+	p[12] = 0x10;
+	p[13] = 0x00;
+	p[14] = 0x00;
+	p[15] = 0xFF;
+	for (i = 0; i < 16 * 4; i++) {
+		p[0x10 + i] = (uint8_t)(dw[i / 4] >> ((i & 3) * 8));
+	}
+}
+
+/* The driver: all of ll_set_io_vdisk(), JesFs must pick those of the flash */
+uint8_t sflash_spi_io_caps(void)
+{
+	return sim_flash.io_mask;
+}
+
+void sflash_spi_read(uint8_t *buf, uint16_t len)
+{
+	uint32_t adr;
+	uint32_t i;
+
+	sim_assert(sim_flash.select);
+	sim_spi_clock(len, sim_flash.lines);
+	sim_flash.spi_bytes_rd += len;
+	switch (sim_flash.state) {
+	case SIM_RD_ID:
+		sim_assert(len == 3);
+		buf[0] = (uint8_t)(sim_flash.id_used >> 16); /* Manufacturer */
+		buf[1] = (uint8_t)(sim_flash.id_used >> 8);  /* Type */
+		buf[2] = (uint8_t)sim_flash.id_used;	     /* Density */
+		sim_flash.state = SIM_DONE;
+		break;
+	case SIM_RD_STATUS: /* As often as you want */
+		sim_assert(len == 1);
+		sim_is_busy();
+		buf[0] = sim_flash.status_reg;
+		break;
+	case SIM_RD_DATA:
+		adr = sim_flash.adr_ptr;
+		sim_assert(adr <= sim_flash.memsize && len <= sim_flash.memsize - adr);
+		if (sim_flash.suspended) {
+			/* The sector under erase is undefined */
+			sim_assert(adr + len <= sim_flash.erase_adr ||
+				   adr >= sim_flash.erase_adr + sim_flash.erase_size);
+		}
+		memcpy(buf, &sim_flash.pmem[adr], len);
+		sim_flash.adr_ptr = adr + len; /* Reads may be continued */
+		break;
+	case SIM_RD_SFDP:
+		memset(buf, 0xFF, len); /* Undefined outside the tables */
+		if (sim_flash.sfdp != LL_SFDP_NONE) {
+			uint8_t sfdp[SIM_SFDP_SIZE];
+
+			sim_sfdp_build(sfdp);
+			for (i = 0; i < len && sim_flash.adr_ptr + i < SIM_SFDP_SIZE; i++) {
+				buf[i] = sfdp[sim_flash.adr_ptr + i];
+			}
+		}
+		sim_flash.adr_ptr += len;
+		break;
+	default:
+		fprintf(stderr, "<LL: ERROR State:%u - Read len:%u Bytes>\n", sim_flash.state, len);
+		sim_assert(0);
+	}
+}
+
+static uint32_t sim_get_adr(const uint8_t *buf)
+{
+	return ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+/* Multi-line command: supported by the flash (and the driver)? */
+static void sim_io_cmd(uint8_t cap, uint8_t lines)
+{
+	sim_assert(cap & sim_flash.io_caps & sim_flash.io_mask);
+	sim_flash.lines = lines;
+}
+
+void sflash_spi_write(const uint8_t *buf, uint16_t len)
+{
+	uint32_t adr;
+	uint32_t i;
+
+	sim_assert(sim_flash.select);
+	sim_flash.spi_bytes_wr += len;
+	if (sim_flash.state != SIM_CMD) {
+		sim_spi_clock(len, sim_flash.lines);
+	} else if (*buf == CMD_QUADIOREAD || *buf == CMD_QUADIOPAGEWRITE) {
+		sim_spi_clock(1, 1); /* The address on 4 lines */
+		sim_spi_clock(len - 1, 4);
+	} else {
+		sim_spi_clock(len, 1);
+	}
+	if (sim_flash.state == SIM_PROGRAM) {
+		/* 2nd transfer of a page program: the data. */
+		adr = sim_flash.adr_ptr;
+		sim_assert(len <= 256 - (adr & 255)); /* No wrap inside the page */
+		sim_assert(adr + len <= sim_flash.memsize);
+		for (i = 0; i < len; i++) {
+			sim_flash.pmem[adr + i] &= buf[i]; /* Can only write zeros */
+		}
+		/* Busy from deselect: tBP per byte, up to tPP for a full page */
+		sim_set_busy(sim_flash.timing.t_bp_us +
+			     (uint64_t)(sim_flash.timing.t_pp_us - sim_flash.timing.t_bp_us) * len / 256);
+		sim_flash.state = SIM_DONE;
+		return;
+	}
+	sim_assert(sim_flash.state == SIM_CMD);
+	if (sim_flash.powerdown) {
+		sim_assert(*buf == CMD_RELEASEDPD); /* A sleeping flash ignores all else */
+	} else {
+		/* Too early after wake up, or busy: a real flash would ignore the command */
+		sim_assert(sim_flash.vtime_ns >= sim_flash.wake_until_ns);
+		if (sim_is_busy()) {
+			sim_assert(*buf == CMD_STATUSREG || *buf == CMD_ERASE_SUSPEND ||
+				   *buf == CMD_ERASE_SUSPEND_SFDP);
+		} else if (sim_flash.suspended) {
+			/* Only reads (no program during erase suspend in JesFs) */
+			sim_assert(*buf == CMD_STATUSREG || *buf == CMD_READDATA ||
+				   *buf == CMD_FASTREAD || *buf == CMD_DUALREAD ||
+				   *buf == CMD_QUADREAD || *buf == CMD_QUADIOREAD ||
+				   *buf == CMD_ERASE_RESUME || *buf == CMD_ERASE_SUSPEND ||
+				   *buf == CMD_ERASE_RESUME_SFDP || *buf == CMD_ERASE_SUSPEND_SFDP);
+		}
+	}
+
+	switch (*buf) {
+	case CMD_DEEPPOWERDOWN:
+		sim_assert(len == 1);
+		sim_flash.powerdown = 1;
+		break;
+	case CMD_RELEASEDPD:
+		sim_assert(len == 1);
+		if (sim_flash.powerdown) {
+			sim_flash.wake_until_ns = sim_flash.vtime_ns + (uint64_t)sim_flash.timing.t_res_us * 1000;
+		}
+		sim_flash.powerdown = 0;
+		break;
+	case CMD_RDID:
+		sim_assert(len == 1);
+		sim_flash.state = SIM_RD_ID;
+		break;
+	case CMD_WRITEENABLE:
+		sim_assert(len == 1);
+		sim_flash.status_reg |= SR_WEL;
+		break;
+	case CMD_STATUSREG:
+		sim_assert(len == 1);
+		sim_flash.state = SIM_RD_STATUS;
+		break;
+
+	case CMD_READDATA:
+		sim_assert(len == 4);
+		sim_flash.adr_ptr = sim_get_adr(buf);
+		sim_flash.state = SIM_RD_DATA;
+		break;
+
+	case CMD_FASTREAD: /* 1 dummy byte */
+	case CMD_DUALREAD:
+	case CMD_QUADREAD:
+		sim_assert(len == 5);
+		if (*buf == CMD_FASTREAD) {
+			sim_io_cmd(SF_IO_FAST_READ, 1);
+		} else if (*buf == CMD_DUALREAD) {
+			sim_io_cmd(SF_IO_DUAL_OUT, 2);
+		} else {
+			sim_io_cmd(SF_IO_QUAD_OUT, 4);
+		}
+		sim_flash.adr_ptr = sim_get_adr(buf);
+		sim_flash.state = SIM_RD_DATA;
+		break;
+
+	case CMD_QUADIOREAD: /* Mode byte (no continuous read) and 2 dummy bytes */
+		sim_assert(len == 7 && buf[4] == 0xFF);
+		sim_io_cmd(SF_IO_QUAD_IO, 4);
+		sim_flash.adr_ptr = sim_get_adr(buf);
+		sim_flash.state = SIM_RD_DATA;
+		break;
+
+	case CMD_READ_SFDP: /* 1 dummy byte */
+		sim_assert(len == 5);
+		sim_flash.adr_ptr = sim_get_adr(buf);
+		sim_flash.state = SIM_RD_SFDP;
+		break;
+
+	case CMD_QUADPAGEWRITE:
+	case CMD_QUADIOPAGEWRITE:
+		sim_io_cmd((*buf == CMD_QUADPAGEWRITE) ? SF_IO_QUAD_PP : SF_IO_QUAD_IO_PP, 4);
+		/* fall through */
+	case CMD_PAGEWRITE: /* 2 transfers: CMD+ADR, then DATA */
+		sim_assert(len == 4);
+		sim_assert(sim_flash.status_reg & SR_WEL);
+		sim_flash.status_reg &= ~SR_WEL;
+		sim_flash.adr_ptr = sim_get_adr(buf);
+		sim_flash.state = SIM_PROGRAM;
+		break;
+
+	case CMD_SECTOR4K_ERASE:
+	case CMD_BLOCK32K_ERASE:
+	case CMD_BLOCK64K_ERASE:
+		sim_assert(len == 4);
+		sim_assert(sim_flash.status_reg & SR_WEL);
+		sim_flash.status_reg &= ~SR_WEL;
+		/* Only the erases of the SFDP */
+		sim_assert(*buf == CMD_SECTOR4K_ERASE || sim_flash.sfdp != LL_SFDP_NO_BLOCKS);
+		if (*buf == CMD_SECTOR4K_ERASE) {
+			sim_flash.erase_size = SF_SECTOR_PH;
+			sim_set_busy(sim_flash.timing.t_se_us);
+		} else if (*buf == CMD_BLOCK32K_ERASE) {
+			sim_flash.erase_size = 0x8000;
+			sim_set_busy(sim_flash.timing.t_be32_us);
+		} else {
+			sim_flash.erase_size = 0x10000;
+			sim_set_busy(sim_flash.timing.t_be64_us);
+		}
+		adr = sim_get_adr(buf);
+		/* The flash ignores the low address bits, JesFs must align */
+		sim_assert((adr & (sim_flash.erase_size - 1)) == 0);
+		sim_assert(adr + sim_flash.erase_size <= sim_flash.memsize);
+		memset(&sim_flash.pmem[adr], 0xFF, sim_flash.erase_size);
+		sim_flash.erase_adr = adr;
+		sim_flash.erasing = 1;
+		break;
+
+	case CMD_ERASE_SUSPEND_SFDP:
+	case CMD_ERASE_SUSPEND: /* Ignored unless a sector or block erase is running */
+		sim_assert(len == 1);
+		if (sim_flash.erasing && !sim_flash.suspended && sim_is_busy()) {
+			sim_flash.erase_rest_ns = sim_flash.busy_until_ns - sim_flash.vtime_ns;
+			sim_flash.suspended = 1;
+			sim_set_busy(sim_flash.timing.t_sus_us); /* WIP until suspended */
+		}
+		break;
+
+	case CMD_ERASE_RESUME_SFDP:
+	case CMD_ERASE_RESUME: /* Ignored unless suspended */
+		sim_assert(len == 1);
+		if (sim_flash.suspended && !sim_is_busy()) {
+			sim_flash.suspended = 0;
+			sim_flash.busy_until_ns = sim_flash.vtime_ns + sim_flash.erase_rest_ns;
+			sim_flash.status_reg |= SR_WIP;
+		}
+		break;
+
+	case CMD_BULKERASE:
+		sim_assert(len == 1);
+		sim_assert(sim_flash.status_reg & SR_WEL);
+		sim_flash.status_reg &= ~SR_WEL;
+		memset(sim_flash.pmem, 0xFF, sim_flash.memsize);
+		sim_set_busy((uint64_t)sim_flash.timing.t_ce_ms_mb * 1000 * sim_flash.memsize / 0x100000);
+		break;
+
+	default:
+		fprintf(stderr, "<LL: ERROR: Write CMD:%02X", *buf);
+		for (i = 1; i < len; i++) {
+			fprintf(stderr, " %02X", buf[i]);
+		}
+		fprintf(stderr, ">\n");
+		sim_assert(0);
+	}
+}
+/* ------------------- Low-level SPI OK ------------------------ */
+
+/* ------------------- Image file helpers ------------------------ */
+int16_t ll_open_vdisk(const char *fname)
+{
+	struct stat st;
+	void *p;
+	uint8_t h;
+	int fd;
+
+	if (!fname || !*fname) {
+		return LL_VDISK_ERR_FNAME;
+	}
+	ll_close_vdisk();
+	if (!sim_flash.id_set) {
+		sim_flash.id_set = SIM_DISK_ID;
+	}
+
+	fd = open(fname, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return LL_VDISK_ERR_OPEN;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		return LL_VDISK_ERR_OPEN;
+	}
+	if (st.st_size) {
+		/* Existing image: its size is the density. */
+		for (h = MIN_DENSITY; h <= MAX_DENSITY; h++) {
+			if (st.st_size == (off_t)1 << h) {
+				break;
+			}
+		}
+		if (h > MAX_DENSITY) {
+			close(fd);
+			return LL_VDISK_ERR_SIZE;
+		}
+		sim_flash.id_set = (sim_flash.id_set & 0xFFFF00) | h;
+	} else if (ftruncate(fd, (off_t)1 << (sim_flash.id_set & 255))) {
+		close(fd);
+		return LL_VDISK_ERR_WRITE;
+	}
+	sim_flash.id_used = sim_flash.id_set;
+	sim_flash.memsize = 1UL << (sim_flash.id_used & 255);
+
+	p = mmap(NULL, sim_flash.memsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return LL_VDISK_ERR_MAP;
+	}
+	sim_flash.pmem = p;
+	sim_flash.fd = fd;
+	if (!st.st_size) {
+		sim_fill_trash();
+	}
+	sim_select_timing();
+	return 0;
+}
+
+int16_t ll_sync_vdisk(void)
+{
+	if (!sim_flash.pmem) {
+		return LL_VDISK_ERR_NO_DISK;
+	}
+	if (sim_flash.fd >= 0 && msync(sim_flash.pmem, sim_flash.memsize, MS_SYNC)) {
+		return LL_VDISK_ERR_WRITE;
+	}
+	return 0;
+}
+
+int16_t ll_close_vdisk(void)
+{
+	int16_t res;
+
+	if (!sim_flash.pmem) {
+		return LL_VDISK_ERR_NO_DISK;
+	}
+	res = ll_sync_vdisk();
+	munmap(sim_flash.pmem, sim_flash.memsize);
+	if (sim_flash.fd >= 0) {
+		close(sim_flash.fd);
+	}
+	sim_flash.pmem = NULL;
+	sim_flash.fd = -1;
+	sim_flash.powerdown = 0;
+	sim_flash.status_reg = 0;
+	sim_flash.busy_until_ns = 0;
+	sim_flash.wake_until_ns = 0;
+	sim_flash.erasing = 0;
+	sim_flash.suspended = 0;
+	return res;
+}
+
+int16_t ll_setid_vdisk(uint32_t id)
+{
+	sim_assert((id & 255) >= MIN_DENSITY && (id & 255) <= MAX_DENSITY);
+	if (id < 256) {
+		id |= (uint32_t)MACRONIX_MANU_TYP_RX << 8;
+	}
+	sim_flash.id_set = id;
+	sim_flash.timing_set = 0; /* Timing of the new type */
+	return 0;
+}
+
+int16_t ll_get_info_vdisk(uint32_t *pid_used, uint8_t **pmem, uint32_t *psize)
+{
+	if (!sim_flash.pmem) {
+		return LL_VDISK_ERR_NO_DISK;
+	}
+	if (pid_used) {
+		*pid_used = sim_flash.id_used;
+	}
+	if (pmem) {
+		*pmem = sim_flash.pmem;
+	}
+	if (psize) {
+		*psize = sim_flash.memsize;
+	}
+	return 0;
+}
+
+int16_t ll_get_timing_vdisk(struct ll_sim_timing *pt)
+{
+	if (!sim_flash.pmem) {
+		return LL_VDISK_ERR_NO_DISK;
+	}
+	*pt = sim_flash.timing;
+	return 0;
+}
+
+int16_t ll_set_timing_vdisk(const struct ll_sim_timing *pt)
+{
+	if (!pt) {
+		sim_flash.timing_set = 0; /* Back to the type's defaults */
+		sim_select_timing();
+		return 0;
+	}
+	if (!pt->spi_hz || pt->t_bp_us > pt->t_pp_us) {
+		return LL_VDISK_ERR_PARAM;
+	}
+	sim_flash.timing = *pt;
+	sim_flash.timing_set = 1;
+	return 0;
+}
+
+void ll_set_io_vdisk(uint8_t mask)
+{
+	sim_flash.io_mask = mask;
+}
+
+void ll_set_sfdp_vdisk(uint8_t mode)
+{
+	sim_flash.sfdp = mode;
+}
+
+uint64_t ll_get_vtime_us(void)
+{
+	return sim_flash.vtime_ns / 1000;
+}
+
+void ll_get_stat_vdisk(struct ll_sim_stat *ps)
+{
+	ps->vtime_us = sim_flash.vtime_ns / 1000;
+	ps->spi_transactions = sim_flash.spi_transactions;
+	ps->spi_bytes_rd = sim_flash.spi_bytes_rd;
+	ps->spi_bytes_wr = sim_flash.spi_bytes_wr;
+}
+/* ------------------- Image file helpers OK ------------------------ */
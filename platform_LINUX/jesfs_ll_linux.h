@@ -0,0 +1,117 @@
+/*******************************************************************************
+ * jesfs_ll_linux.h: Helpers for the Linux flash simulation (jesfs_ll_linux.c)
+ *
+ * JesFs - Jo's Embedded Serial File System
+ *
+ * Only host applications (demo, tools) need this header. The JesFs core
+ * talks to the simulation through the low-level functions in jesfs_int.h.
+ *
+ * (C) joembedded@gmail.com - www.joembedded.de
+ *
+ * Version: see jesfs.h
+ *
+ *******************************************************************************/
+
+#ifndef JESFS_LL_LINUX_H
+#define JESFS_LL_LINUX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Results of the ll_xxx_vdisk() helpers (0: OK). */
+#define LL_VDISK_ERR_FNAME -200	     /* Filename too short */
+#define LL_VDISK_ERR_OPEN -201	     /* Image file cannot be opened/created */
+#define LL_VDISK_ERR_WRITE -202	     /* Image file cannot be resized/written */
+#define LL_VDISK_ERR_SIZE -205	     /* Image file size is not a legal flash size */
+#define LL_VDISK_ERR_NO_DISK -206    /* No disk mapped (call sflash_spi_init() first) */
+#define LL_VDISK_ERR_MAP -207	     /* mmap() failed */
+#define LL_VDISK_ERR_PARAM -208	     /* Illegal parameter */
+
+/*
+ * Timing model of the simulated flash. Defaults are the typical datasheet
+ * values of the flash type (JEDEC ID), see jesfs_ll_linux.c.
+ */
+struct ll_sim_timing {
+	uint32_t spi_hz;     /* SPI clock */
+	uint32_t t_bp_us;    /* Byte program (first byte of a page program) */
+	uint32_t t_pp_us;    /* Page program, 256 bytes */
+	uint32_t t_se_us;    /* Sector erase, 4k */
+	uint32_t t_be32_us;  /* Block erase, 32k */
+	uint32_t t_be64_us;  /* Block erase, 64k */
+	uint32_t t_ce_ms_mb; /* Bulk (chip) erase, per MB flash size */
+	uint32_t t_res_us;   /* Release from deep power down */
+	uint32_t t_sus_us;   /* Erase suspend latency */
+};
+
+/* Running totals of the simulation (never reset, use differences). */
+struct ll_sim_stat {
+	uint64_t vtime_us;	   /* Virtual time, see ll_get_vtime_us() */
+	uint32_t spi_transactions; /* Select..deselect cycles */
+	uint64_t spi_bytes_rd;	   /* Bytes from the flash */
+	uint64_t spi_bytes_wr;	   /* Bytes to the flash (incl. commands) */
+};
+
+/*
+ * Use an image file as flash. An existing image keeps its contents and its
+ * size selects the density; a new or empty file is created with the density
+ * of the current ID and filled with 'trash' (needs jesfs_format()).
+ * The file stays mapped until ll_close_vdisk(), so no load/save copy is needed.
+ */
+int16_t ll_open_vdisk(const char *fname);
+
+/* Flush (msync) and unmap the disk. The next sflash_spi_init() maps again. */
+int16_t ll_close_vdisk(void);
+
+/* Flush the mapped image to its file (msync). */
+int16_t ll_sync_vdisk(void);
+
+/*
+ * Set the JEDEC ID 0xMMTTDD for the simulated flash. IDs < 256 are only a
+ * density and use the Macronix MX25R type. Takes effect on the next
+ * sflash_spi_init(); a different density creates a new (anonymous) disk.
+ */
+int16_t ll_setid_vdisk(uint32_t id);
+
+/* Get ID, memory and size of the current disk (each pointer optional). */
+int16_t ll_get_info_vdisk(uint32_t *pid_used, uint8_t **pmem, uint32_t *psize);
+
+/* Get the timing of the current disk. */
+int16_t ll_get_timing_vdisk(struct ll_sim_timing *pt);
+
+/*
+ * Use a different timing for the current disk (e.g. another SPI clock).
+ * NULL: back to the defaults of the flash type. ll_setid_vdisk() also resets.
+ */
+int16_t ll_set_timing_vdisk(const struct ll_sim_timing *pt);
+
+/*
+ * Multi-line commands the simulated driver reports in sflash_spi_io_caps()
+ * (JESFS_MULTI_IO): mask (SF_IO_xxx, see jesfs_int.h, default: all), e.g. 0
+ * for 1-line SPI. The flash type sets which of them exist, others are
+ * rejected. Takes effect on the next jesfs_start().
+ */
+void ll_set_io_vdisk(uint8_t mask);
+
+/*
+ * SFDP of the simulated flash (read with 0x5A). Unknown flash types are only
+ * accepted by JesFs with an SFDP (JESFS_SFDP). Takes effect on the next
+ * jesfs_start() with a new ID.
+ */
+#define LL_SFDP_NONE 0	    /* No SFDP, reads 0xFF */
+#define LL_SFDP_FULL 1	    /* Default */
+#define LL_SFDP_NO_BLOCKS 2 /* Only the 4k erase, 0x52/0xD8 are illegal */
+void ll_set_sfdp_vdisk(uint8_t mode);
+
+/* Virtual time in usec: SPI transfers, sflash_wait_usec() and flash busy. */
+uint64_t ll_get_vtime_us(void);
+
+/* Get the SPI and time totals. */
+void ll_get_stat_vdisk(struct ll_sim_stat *ps);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* JESFS_LL_LINUX_H */
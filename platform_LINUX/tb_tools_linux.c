@@ -0,0 +1,153 @@
+/*********************************************************************
+* tb_tools_linux.c - Toolbox for UART, Unix-Time, ..
+*
+* For Platform __linux__ (host build with the simulated flash,
+* see jesfs_ll_linux.c). The 'UART' is stdin/stdout.
+*
+* (C) joembedded.de
+* Version:
+* 1.0  / 17.10.2026
+*********************************************************************/
+
+#define _DEFAULT_SOURCE	// usleep()
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h> // for var_args
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifndef __linux__
+#error "Toolbox for __linux__"
+#endif
+
+#include "tb_tools.h"
+
+// --- locals timestamp ----
+static bool tb_init_flag=false;
+static int32_t tb_time_offset; // Set by tb_time_set()
+
+// -------- init Toolbox -----------------
+void tb_init(void){
+	tb_init_flag=true;
+}
+
+// ------ uninit all --------------------
+void tb_uninit(void){
+	fflush(stdout);
+	tb_init_flag=false;
+}
+
+// ------ board support pakage -----
+// No LEDs/Buttons on the host
+void tb_board_led_on(uint8_t idx){
+}
+void tb_board_led_off(uint8_t idx){
+}
+void tb_board_led_invert(uint8_t idx){
+}
+bool tb_board_button_state(uint8_t idx){
+	return false;
+}
+
+// ------- System Reset -------------
+// The (mmap()ed) flash image file survives the exit
+void tb_system_reset(void){
+	fflush(stdout);
+	exit(-1);
+}
+
+// ---- No Watchdog on the host -----------
+uint32_t tb_watchdog_init(void){
+	return 0;
+}
+void tb_watchdog_feed(uint32_t feed_ticks){
+}
+bool tb_is_wd_init(void){
+	return false;
+}
+
+// --- A low Power delay ---
+void tb_delay_ms(uint32_t msec){
+	fflush(stdout);
+	usleep(msec*1000);
+}
+
+// ---- Unix-Timer ---
+uint32_t tb_time_get(void){
+	return (uint32_t)time(NULL)+tb_time_offset;
+}
+
+// Set time, regarding the timer (the system clock is not changed)
+void tb_time_set(uint32_t new_secs){
+	tb_time_offset=(int32_t)(new_secs-(uint32_t)time(NULL));
+}
+
+// ----- fine clock ticks functions ---------------------
+// Use the difference of 2 timestamps to calculate msec Time
+uint32_t tb_get_ticks(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint32_t)(ts.tv_sec*1000+ts.tv_nsec/1000000);	// msec
+}
+
+uint32_t tb_deltaticks_to_ms(uint32_t t0, uint32_t t1){
+	return t1-t0;
+}
+
+// tb_printf(): printf() to toolbox uart.
+void tb_printf(const char* fmt, ...){
+	va_list argptr;
+	va_start(argptr, fmt);
+	vprintf(fmt, argptr);
+	va_end(argptr);
+}
+
+// tb_putsl - as puts, but without CR/NL
+void tb_putsl(const char* pc){
+	fputs(pc,stdout);
+}
+
+// tb_putc(): Wait if not ready
+int16_t tb_putc(char c){
+	putchar(c);
+	return 0;
+}
+
+// ---- Input functions 0: Nothing available ---------
+int16_t tb_kbhit(void){
+	struct pollfd pfd = { .fd=STDIN_FILENO, .events=POLLIN };
+	return (int16_t)(poll(&pfd,1,0)>0);
+}
+
+// ---- get 1 char (0..255) (or -1 if nothing available)
+int16_t tb_getc(void){
+	uint8_t c;
+	if(!tb_kbhit()) return -1;
+	if(read(STDIN_FILENO,&c,1)!=1) return -1;
+	return (int16_t)c;
+}
+
+// Get String with Timout (if >0) in msec of infinite (Timout 0)
+// stdin is line buffered by the terminal, which also does the echo.
+// On end of input (e.g. a script piped to the demo) the program exits.
+int16_t tb_gets(char* input, int16_t max_uart_in, uint16_t max_wait_ms, uint8_t echo){
+	struct pollfd pfd = { .fd=STDIN_FILENO, .events=POLLIN };
+	char *pc;
+
+	fflush(stdout);
+	*input=0;
+	if(poll(&pfd,1,max_wait_ms?max_wait_ms:-1)<=0) return 0; // Timeout: empty string
+	if(!fgets(input,max_uart_in+1,stdin)){
+		tb_system_reset();
+	}
+	pc=strpbrk(input,"\r\n");
+	if(pc) *pc=0;
+	return (int16_t)strlen(input);
+}
+//***
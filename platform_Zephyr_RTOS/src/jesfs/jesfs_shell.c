@@ -294,6 +294,8 @@ static int16_t js_handle_start_command(uint8_t flags, char *args)
 			cmd = FS_START_FAST;
 		} else if (!strcmp(args, "restart")) {
 			cmd = FS_START_RESTART;
+		} else if (!strcmp(args, "full")) {
+			cmd = FS_START_NORMAL | FS_START_FULLSCAN; /* Ignore a checkpoint */
 		} else
 			return -EINVAL;
 	}
@@ -401,7 +403,8 @@ int16_t js_handle_dir_command(uint8_t flags, char *args)
 				tb_log(flags, " CRC32:%x", fs_stat.file_crc32);
 			if (fs_stat.disk_flags & SF_OPEN_EXT_SYNC)
 				tb_log(flags, " ExtSync");
-			// if(fs_stat.disk_flags & _SF_OPEN_RES) tb_log(flags, " Reserved");
+			if (fs_stat.disk_flags & SF_OPEN_RING)
+				tb_log(flags, " Ring");
 			conv_secs_to_date_buffer(fs_stat.file_ctime, date_buffer, DBUF_SIZE);
 			tb_log(flags, " [%s]\n", date_buffer);
 		}
@@ -445,6 +448,49 @@ int16_t js_handle_check_command(uint8_t flags, char *args)
 	return res;
 }
 
+#ifdef JSTAT
+// Show the SPI/flash access counters, optionally reset them.
+int16_t js_handle_stat_command(uint8_t flags, char *args)
+{
+	struct jesfs_spi_stat stat;
+
+	while (*args == ' ')
+		args++;
+	if (*args && strcmp(args, "reset"))
+		return -EINVAL;
+
+	jesfs_get_spi_stat(&stat);
+	tb_log(flags, "SPI Transactions: %u\n", stat.transactions);
+	tb_log(flags, "Reads: %u (%u Bytes)\n", stat.reads, stat.bytes_read);
+	tb_log(flags, "Programs: %u (%u Bytes)\n", stat.programs, stat.bytes_written);
+	tb_log(flags, "Erases: %u, Block: %u, Bulk: %u\n", stat.erases, stat.block_erases,
+	       stat.bulk_erases);
+	tb_log(flags, "Status Reads: %u\n", stat.status_reads);
+	tb_log(flags, "Busy: %u Polls (%u msec)\n", stat.busy_polls, stat.busy_usec / 1000);
+	if (*args) {
+		jesfs_reset_spi_stat();
+		tb_log(flags, "Counters reset\n");
+	}
+	return 0;
+}
+#endif
+
+#ifdef JESFS_GC
+// Erase deleted sectors now (default: all), instead of on the next write.
+int16_t js_handle_gc_command(uint8_t flags, char *args)
+{
+	uint16_t max_erase = 0xFFFF;
+	int16_t res;
+
+	if (*args != '\0') {
+		max_erase = (uint16_t)strtoul(args, NULL, 0);
+	}
+	res = jesfs_gc(max_erase);
+	tb_log(flags, "jesfs_gc(%u)=%d\n", max_erase, res);
+	return res < 0 ? res : 0;
+}
+#endif
+
 int16_t js_handle_open_command(uint8_t flags, char *args)
 {
 	while (*args == ' ')
@@ -739,11 +785,17 @@ static const tb_command_entry_t js_commands[] = {
 	 "jedec | sread <addr> [len] | swrite <addr> <b0..b15> | serase <addr> <len>"},
 
 	// Filesystem lifecycle commands.
-	{"start", js_handle_start_command, "[normal|fast|restart] (Default: normal)"},
+	{"start", js_handle_start_command, "[normal|fast|restart|full] (Default: normal)"},
 	{"deepsleep", js_handle_deepsleep_command, NULL},
 	{"format", js_handle_format_command, NULL},
 	{"dir", js_handle_dir_command, NULL},
 	{"check", js_handle_check_command, NULL},
+#ifdef JSTAT
+	{"stat", js_handle_stat_command, "[reset] (SPI/flash access counters)"},
+#endif
+#ifdef JESFS_GC
+	{"gc", js_handle_gc_command, "[max_erase] (Erase deleted sectors, Default: all)"},
+#endif
 
 	// File operation commands (open file descriptor required where noted).
 	{"open", js_handle_open_command,
@@ -96,7 +96,7 @@ void helper_show_directory(void){
 				// The creation Flags
 				if(fs_stat.disk_flags & SF_OPEN_CRC) tb_printf(" CRC32:%x",fs_stat.file_crc32);
 				if(fs_stat.disk_flags & SF_OPEN_EXT_SYNC) tb_printf(" ExtSync");
-				//if(fs_stat.disk_flags & _SF_OPEN_RES) tb_printf(" Reserved");
+				if(fs_stat.disk_flags & SF_OPEN_RING) tb_printf(" Ring");
 
 				helper_conv_secs_to_date(fs_stat.file_ctime, dbuffer);
 				tb_printf(" [%s]\n",dbuffer);
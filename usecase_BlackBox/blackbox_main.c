@@ -49,7 +49,7 @@ static uint8_t sbuffer[256]; // Test buffer (universal use)
 #define MAX_INPUT 80
 static char input[MAX_INPUT+1];
 
-#define HISTORY     1000    // Max. History for Data in Bytes
+#define HISTORY     1000    // Min. History for Data in Bytes (Ring file)
 static int32_t value=0;     // Sample Value to record
 
 /*****************************************************************
@@ -69,15 +69,16 @@ int16_t _supply_voltage_check(void){
 * This funktion logs one line to the the history
 ********************************************************************/
 int16_t log_blackbox(char* logtext, uint16_t len){
-	FS_DESC fs_desc, fs_desc_sec;    // 2 JesFs file descriptors
+	FS_DESC fs_desc;    // JesFs file descriptor
 	int16_t res;
 
 	res=fs_start(FS_START_RESTART);
 	if(res) return res;
 
-	// Flags (see docu): Create File if not exists and open in RAW-mode,
-	// in RAW-Mode file is not truncated if existing
-	res=fs_open(&fs_desc,"Data.pri",SF_OPEN_CREATE|SF_OPEN_RAW);
+	// Ring file (see docu): Create File if not exists and open in RAW-mode,
+	// in RAW-Mode file is not truncated if existing. Keeps at least HISTORY
+	// Bytes, older data is dropped sector by sector
+	res=fs_open_ring(&fs_desc,"Data.pri",SF_OPEN_RAW,HISTORY);
 	if(res) return res;
 
 	// Place (internal) file pointer to the end of the file to allow write
@@ -90,27 +91,14 @@ int16_t log_blackbox(char* logtext, uint16_t len){
 	// Show what was written
 	tb_printf("Pos:%u Log:%s",fs_desc.file_len,logtext);
 
-	// Now make a file shift if more data than HISTORY
-	if(fs_desc.file_len>= HISTORY){
-
-		tb_printf("Shift 'Data.pri' -> 'Data.sec'\n");
-
-		// Optionally delete and (create in any case) backup file
-		res=fs_open(&fs_desc_sec,"Data.sec",SF_OPEN_CREATE);
-		if(res) return res;
-
-		// rename (full) data file to secondary file
-		res=fs_rename(&fs_desc,&fs_desc_sec);
-		if(res) return res;
-	}
 	fs_deepsleep(); // Set Filesystem to UltraLowPowerMode
 	return 0;   // OK
 }
 
 /*******************************************************************
 * run_blackbox(asec)
-* Take a record each asec secs, until Data.pri is >= HISTORY,
-* then shift it to Data.sec and delete Data.pri.
+* Take a record each asec secs, Data.pri keeps the last HISTORY
+* Bytes (or more). 'Data.sec' is only used by older versions.
 * This demo uses "unclosed Files", which is very useful here.
 * Run recoder loop *FOREVER* or until user hits key
 ********************************************************************/
@@ -209,7 +197,7 @@ void *main(void *arg0){
 	tb_printf("'! [SECONDS]' Print Time or optionally set UNIX-Seconds\n");
 	tb_printf("'q'           Exit (on __WIN32__/WIN32: save Disk as File 'default.disk')\n\n");
 
-	tb_printf("Init-JesFS: Res:%d\n",fs_start(FS_START_NORMAL));  // Unformated: Return JESFS_ERR_BAD_MAGIC (see jesfs.h)
+	tb_printf("Init-JesFS: Res:%d\n",fs_start(FS_START_NORMAL));  // Unformated: Return JESFS_ERR_BAD_MAGIC (see jesfs.h)
 
 	while (1) {
 		tb_board_led_invert(0); // Toggle LED (if available)